@@ -485,5 +485,14 @@ main (int argc, char *argv[])
         g_debug ("SettingsDaemon finished");
         mate_settings_profile_end (NULL);
 
+        if (g_getenv ("MATE_SETTINGS_PROFILE_FILE") != NULL) {
+                GError *error = NULL;
+
+                if (!mate_settings_profile_write (g_getenv ("MATE_SETTINGS_PROFILE_FILE"), &error)) {
+                        g_warning ("Unable to write the profile: %s", error->message);
+                        g_error_free (error);
+                }
+        }
+
         return 0;
 }
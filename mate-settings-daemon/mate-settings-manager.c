@@ -49,6 +49,12 @@ static const gchar introspection_xml[] =
 "  <interface name='org.mate.SettingsDaemon'>"
 "    <method name='Awake'/>"
 "    <method name='Start'/>"
+"    <method name='ActivatePlugin'>"
+"      <arg name='name' type='s' direction='in'/>"
+"    </method>"
+"    <method name='GetProfile'>"
+"      <arg name='trace' type='s' direction='out'/>"
+"    </method>"
 "    <signal name='PluginActivated'>"
 "      <arg name='name' type='s'/>"
 "    </signal>"
@@ -66,6 +72,9 @@ struct MateSettingsManagerPrivate
         GCancellable               *cancellable;
 
         GSList                     *plugins;
+        GHashTable                 *schema_index;
+        GHashTable                 *lazy_plugins;
+        GHashTable                 *load_priorities;    /* plugin -> priority its load pass is picked by */
         gint                        init_load_priority;
         gint                        load_init_flag;
 };
@@ -80,6 +89,22 @@ static guint signals [LAST_SIGNAL] = { 0, };
 
 G_DEFINE_TYPE_WITH_PRIVATE (MateSettingsManager, mate_settings_manager, G_TYPE_OBJECT)
 
+/* A lazy plugin waiting for (or started by) one of its ActivateOnName
+ * bus names */
+typedef struct {
+        MateSettingsManager    *manager;
+        MateSettingsPluginInfo *info;
+        guint                  *watch_ids;
+        guint                   n_present;
+        guint                   unload_id;
+} LazyPlugin;
+
+static gboolean activate_with_requires (MateSettingsManager    *manager,
+                                        MateSettingsPluginInfo *info,
+                                        GHashTable             *visiting);
+static MateSettingsPluginInfo *find_plugin (MateSettingsManager *manager,
+                                            const char          *location);
+
 static gpointer manager_object = NULL;
 
 GQuark
@@ -93,24 +118,202 @@ mate_settings_manager_error_quark (void)
         return ret;
 }
 
+/* The priority that decides the load pass of @info: its own, or that of
+ * the latest plugin it requires, so that it never starts before them */
+static int
+get_load_priority (MateSettingsPluginInfo *info,
+                   MateSettingsManager    *manager)
+{
+        gpointer priority;
+
+        if (g_hash_table_lookup_extended (manager->priv->load_priorities, info, NULL, &priority))
+                return GPOINTER_TO_INT (priority);
+
+        return mate_settings_plugin_info_get_priority (info);
+}
+
+/* Whether @info belongs to the current load pass (all, init or deferred) */
+static gboolean
+is_in_load_pass (MateSettingsPluginInfo *info,
+                 MateSettingsManager    *manager)
+{
+        int plugin_priority;
+
+        plugin_priority = get_load_priority (info, manager);
+
+        return (manager->priv->load_init_flag == PLUGIN_LOAD_ALL ||
+               (manager->priv->load_init_flag == PLUGIN_LOAD_INIT && plugin_priority <= manager->priv->init_load_priority) ||
+               (manager->priv->load_init_flag == PLUGIN_LOAD_DEFER && plugin_priority > manager->priv->init_load_priority));
+}
+
+static void
+lazy_plugin_free (LazyPlugin *lazy)
+{
+        guint i;
+
+        for (i = 0; lazy->watch_ids[i] != 0; i++)
+                g_bus_unwatch_name (lazy->watch_ids[i]);
+        g_free (lazy->watch_ids);
+
+        if (lazy->unload_id != 0)
+                g_source_remove (lazy->unload_id);
+
+        g_object_unref (lazy->info);
+        g_free (lazy);
+}
+
+/* Whether an active plugin lists @info in its Requires key */
+static gboolean
+is_required_by_active_plugin (MateSettingsManager    *manager,
+                              MateSettingsPluginInfo *info)
+{
+        const char *location = mate_settings_plugin_info_get_location (info);
+        GSList     *l;
+
+        for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                const char **requires;
+
+                if (l->data == info || !mate_settings_plugin_info_is_active (l->data))
+                        continue;
+
+                requires = mate_settings_plugin_info_get_requires (l->data);
+                if (requires != NULL && g_strv_contains ((const gchar * const *) requires, location))
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+static gboolean lazy_unload_cb (LazyPlugin *lazy);
+
+/* Deactivates @lazy after its timeout, once nothing uses it any more */
+static void
+lazy_schedule_unload (LazyPlugin *lazy)
+{
+        int timeout;
+
+        timeout = mate_settings_plugin_info_get_lazy_unload_timeout (lazy->info);
+        if (lazy->n_present == 0 && timeout > 0 && lazy->unload_id == 0 &&
+            mate_settings_plugin_info_is_active (lazy->info)) {
+                lazy->unload_id = g_timeout_add_seconds (timeout, (GSourceFunc) lazy_unload_cb, lazy);
+        }
+}
+
+static gboolean
+lazy_unload_cb (LazyPlugin *lazy)
+{
+        MateSettingsManager  *manager = lazy->manager;
+        const char          **requires;
+
+        /* an active plugin depends on it: check again later */
+        if (is_required_by_active_plugin (manager, lazy->info)) {
+                g_debug ("Plugin %s: unused, but still required",
+                         mate_settings_plugin_info_get_location (lazy->info));
+                return G_SOURCE_CONTINUE;
+        }
+
+        lazy->unload_id = 0;
+
+        g_debug ("Plugin %s: unused, deactivating",
+                 mate_settings_plugin_info_get_location (lazy->info));
+        mate_settings_plugin_info_deactivate (lazy->info);
+
+        /* lazy plugins that were only kept for this one may go as well */
+        requires = mate_settings_plugin_info_get_requires (lazy->info);
+        for (; requires != NULL && *requires != NULL; requires++) {
+                MateSettingsPluginInfo *dep = find_plugin (manager, *requires);
+                LazyPlugin             *dep_lazy;
+
+                dep_lazy = dep != NULL ? g_hash_table_lookup (manager->priv->lazy_plugins, dep) : NULL;
+                if (dep_lazy != NULL)
+                        lazy_schedule_unload (dep_lazy);
+        }
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+lazy_name_appeared_cb (GDBusConnection *connection,
+                       const gchar     *name,
+                       const gchar     *name_owner,
+                       LazyPlugin      *lazy)
+{
+        lazy->n_present++;
+
+        if (lazy->unload_id != 0) {
+                g_source_remove (lazy->unload_id);
+                lazy->unload_id = 0;
+        }
+
+        if (!mate_settings_plugin_info_is_active (lazy->info) &&
+            mate_settings_plugin_info_get_enabled (lazy->info)) {
+                g_debug ("Plugin %s: %s appeared, activating",
+                         mate_settings_plugin_info_get_location (lazy->info), name);
+                activate_with_requires (lazy->manager, lazy->info, NULL);
+        }
+}
+
+static void
+lazy_name_vanished_cb (GDBusConnection *connection,
+                       const gchar     *name,
+                       LazyPlugin      *lazy)
+{
+        /* also called once at startup for names that are not on the bus */
+        if (lazy->n_present > 0)
+                lazy->n_present--;
+
+        lazy_schedule_unload (lazy);
+}
+
+/* Instead of starting a lazy plugin, watch the bus names that trigger
+ * it; it can also be started through the ActivatePlugin method. */
+static void
+arm_lazy_plugin (MateSettingsPluginInfo *info,
+                 MateSettingsManager    *manager)
+{
+        LazyPlugin   *lazy;
+        const char  **names;
+        guint         n_names;
+        guint         i;
+
+        if (g_hash_table_contains (manager->priv->lazy_plugins, info))
+                return;
+
+        names = mate_settings_plugin_info_get_activate_on_names (info);
+        n_names = names != NULL ? g_strv_length ((gchar **) names) : 0;
+
+        lazy = g_new0 (LazyPlugin, 1);
+        lazy->manager = manager;
+        lazy->info = g_object_ref (info);
+        lazy->watch_ids = g_new0 (guint, n_names + 1);
+        g_hash_table_insert (manager->priv->lazy_plugins, info, lazy);
+
+        for (i = 0; i < n_names; i++) {
+                lazy->watch_ids[i] = g_bus_watch_name (G_BUS_TYPE_SESSION,
+                                                       names[i],
+                                                       G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                       (GBusNameAppearedCallback) lazy_name_appeared_cb,
+                                                       (GBusNameVanishedCallback) lazy_name_vanished_cb,
+                                                       lazy,
+                                                       NULL);
+        }
+
+        g_debug ("Plugin %s: lazy, waiting for first use",
+                 mate_settings_plugin_info_get_location (info));
+}
+
 static void
 maybe_activate_plugin (MateSettingsPluginInfo *info,
                        MateSettingsManager    *manager)
 {
         if (mate_settings_plugin_info_get_enabled (info)) {
-                int plugin_priority;
-                plugin_priority = mate_settings_plugin_info_get_priority (info);
-
-                if (manager->priv->load_init_flag == PLUGIN_LOAD_ALL ||
-                   (manager->priv->load_init_flag == PLUGIN_LOAD_INIT && plugin_priority <= manager->priv->init_load_priority) ||
-                   (manager->priv->load_init_flag == PLUGIN_LOAD_DEFER && plugin_priority > manager->priv->init_load_priority)) {
-                        gboolean res;
-                        res = mate_settings_plugin_info_activate (info);
-                        if (res) {
-                                g_debug ("Plugin %s: active", mate_settings_plugin_info_get_location (info));
-                        } else {
-                                g_debug ("Plugin %s: activation failed", mate_settings_plugin_info_get_location (info));
-                        }
+                if (is_in_load_pass (info, manager) &&
+                    mate_settings_plugin_info_get_lazy (info)) {
+                        if (mate_settings_plugin_info_supports_display (info))
+                                arm_lazy_plugin (info, manager);
+                } else if (is_in_load_pass (info, manager)) {
+                        /* lazy plugins it requires are only armed so far */
+                        activate_with_requires (manager, info, NULL);
                 } else {
                         g_debug ("Plugin %s: loading deferred or previously loaded", mate_settings_plugin_info_get_location (info));
                 }
@@ -143,6 +346,261 @@ compare_priority (MateSettingsPluginInfo *a,
         return mate_settings_plugin_info_get_priority (a) - mate_settings_plugin_info_get_priority (b);
 }
 
+static MateSettingsPluginInfo *
+find_plugin (MateSettingsManager *manager,
+             const char          *location)
+{
+        GSList *l;
+
+        for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                if (g_strcmp0 (mate_settings_plugin_info_get_location (l->data), location) == 0)
+                        return l->data;
+        }
+
+        return NULL;
+}
+
+/* Activates @info on demand, outside of the load passes, after the
+ * plugins it requires; a lazy plugin that is in use is kept loaded */
+static gboolean
+activate_with_requires (MateSettingsManager    *manager,
+                        MateSettingsPluginInfo *info,
+                        GHashTable             *visiting)
+{
+        const char **requires;
+        LazyPlugin  *lazy;
+        gboolean     owns_visiting = FALSE;
+        gboolean     res;
+
+        lazy = g_hash_table_lookup (manager->priv->lazy_plugins, info);
+        if (lazy != NULL && lazy->unload_id != 0) {
+                g_source_remove (lazy->unload_id);
+                lazy->unload_id = 0;
+        }
+
+        if (mate_settings_plugin_info_is_active (info))
+                return TRUE;
+
+        if (visiting == NULL) {
+                visiting = g_hash_table_new (g_direct_hash, g_direct_equal);
+                owns_visiting = TRUE;
+        } else if (g_hash_table_contains (visiting, info)) {
+                g_warning ("Plugin %s: circular Requires, ignoring the dependency",
+                           mate_settings_plugin_info_get_location (info));
+                return FALSE;
+        }
+        g_hash_table_add (visiting, info);
+
+        requires = mate_settings_plugin_info_get_requires (info);
+        for (; requires != NULL && *requires != NULL; requires++) {
+                MateSettingsPluginInfo *dep;
+
+                dep = find_plugin (manager, *requires);
+                if (dep == NULL || !mate_settings_plugin_info_get_enabled (dep)) {
+                        g_debug ("Plugin %s: required plugin %s is not available",
+                                 mate_settings_plugin_info_get_location (info), *requires);
+                        continue;
+                }
+
+                activate_with_requires (manager, dep, visiting);
+        }
+
+        res = mate_settings_plugin_info_activate (info);
+        g_debug ("Plugin %s: %s", mate_settings_plugin_info_get_location (info),
+                 res ? "active" : "activation failed");
+
+        if (owns_visiting)
+                g_hash_table_destroy (visiting);
+
+        return res;
+}
+
+enum {
+        ORDER_VISITING = 1,
+        ORDER_DONE
+};
+
+static void
+order_plugin (MateSettingsManager    *manager,
+              MateSettingsPluginInfo *info,
+              GHashTable             *state,
+              GSList                **ordered)
+{
+        const char **requires;
+        int          priority;
+
+        switch (GPOINTER_TO_INT (g_hash_table_lookup (state, info))) {
+        case ORDER_DONE:
+                return;
+        case ORDER_VISITING:
+                g_warning ("Plugin %s: circular Requires, ignoring the dependency",
+                           mate_settings_plugin_info_get_location (info));
+                return;
+        default:
+                break;
+        }
+
+        g_hash_table_insert (state, info, GINT_TO_POINTER (ORDER_VISITING));
+
+        priority = mate_settings_plugin_info_get_priority (info);
+
+        requires = mate_settings_plugin_info_get_requires (info);
+        for (; requires != NULL && *requires != NULL; requires++) {
+                MateSettingsPluginInfo *dep;
+                int                     dep_priority;
+
+                dep = find_plugin (manager, *requires);
+                if (dep == NULL) {
+                        g_debug ("Plugin %s: required plugin %s is not installed",
+                                 mate_settings_plugin_info_get_location (info), *requires);
+                        continue;
+                }
+
+                order_plugin (manager, dep, state, ordered);
+
+                /* start in the same pass as the plugin we need, or later */
+                dep_priority = get_load_priority (dep, manager);
+                if (dep_priority > priority) {
+                        if (priority <= manager->priv->init_load_priority &&
+                            dep_priority > manager->priv->init_load_priority)
+                                g_message ("Plugin %s: requires %s, which is deferred; deferring it as well",
+                                           mate_settings_plugin_info_get_location (info), *requires);
+                        priority = dep_priority;
+                }
+        }
+
+        g_hash_table_insert (manager->priv->load_priorities, info, GINT_TO_POINTER (priority));
+        g_hash_table_insert (state, info, GINT_TO_POINTER (ORDER_DONE));
+        *ordered = g_slist_prepend (*ordered, info);
+}
+
+/* Reorders the priority-sorted plugin list so that every plugin comes
+ * after the plugins named in its Requires key; otherwise the priority
+ * order is kept.  A plugin is also moved to the load pass of the latest
+ * plugin it requires. */
+static void
+order_by_requires (MateSettingsManager *manager)
+{
+        GHashTable *state;
+        GSList     *ordered = NULL;
+        GSList     *l;
+
+        g_hash_table_remove_all (manager->priv->load_priorities);
+
+        state = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (l = manager->priv->plugins; l != NULL; l = l->next)
+                order_plugin (manager, l->data, state, &ordered);
+        g_hash_table_destroy (state);
+
+        g_slist_free (manager->priv->plugins);
+        manager->priv->plugins = g_slist_reverse (ordered);
+}
+
+typedef struct {
+        MateSettingsPluginInfo *info;
+        GModule                *library;
+        gboolean                done;
+} PreloadJob;
+
+typedef struct {
+        GMutex      lock;
+        GCond       cond;
+        GThreadPool *pool;
+        GHashTable  *jobs;      /* info -> PreloadJob */
+} PluginPreloader;
+
+static void
+preload_thread (PreloadJob      *job,
+                PluginPreloader *preloader)
+{
+        GModule *library;
+
+        mate_settings_profile_start ("%s", mate_settings_plugin_info_get_location (job->info));
+        library = mate_settings_plugin_info_open_module (job->info);
+        mate_settings_profile_end ("%s", mate_settings_plugin_info_get_location (job->info));
+
+        g_mutex_lock (&preloader->lock);
+        job->library = library;
+        job->done = TRUE;
+        g_cond_broadcast (&preloader->cond);
+        g_mutex_unlock (&preloader->lock);
+}
+
+static void
+preload_job_free (PreloadJob *job)
+{
+        if (job->library != NULL)
+                g_module_close (job->library);
+        g_object_unref (job->info);
+        g_free (job);
+}
+
+static void
+preload_wait (PluginPreloader        *preloader,
+              MateSettingsPluginInfo *info)
+{
+        PreloadJob *job;
+
+        job = g_hash_table_lookup (preloader->jobs, info);
+        if (job == NULL)
+                return;
+
+        g_mutex_lock (&preloader->lock);
+        while (!job->done)
+                g_cond_wait (&preloader->cond, &preloader->lock);
+        g_mutex_unlock (&preloader->lock);
+}
+
+/* Activates the plugins of the current pass in list order.  The modules
+ * are mapped concurrently on worker threads beforehand; activation itself
+ * talks to GTK and X and stays on the main thread, waiting only for the
+ * module of the plugin it is about to start. */
+static void
+activate_plugins (MateSettingsManager *manager)
+{
+        PluginPreloader preloader;
+        GSList         *l;
+
+        mate_settings_profile_start (NULL);
+
+        g_mutex_init (&preloader.lock);
+        g_cond_init (&preloader.cond);
+        preloader.jobs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                NULL, (GDestroyNotify) preload_job_free);
+        preloader.pool = g_thread_pool_new ((GFunc) preload_thread, &preloader,
+                                            g_get_num_processors (), FALSE, NULL);
+
+        for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                MateSettingsPluginInfo *info = l->data;
+                PreloadJob             *job;
+
+                if (!mate_settings_plugin_info_get_enabled (info) ||
+                    mate_settings_plugin_info_get_lazy (info) ||
+                    !is_in_load_pass (info, manager) ||
+                    !mate_settings_plugin_info_is_available (info) ||
+                    mate_settings_plugin_info_is_active (info) ||
+                    !mate_settings_plugin_info_supports_display (info))
+                        continue;
+
+                job = g_new0 (PreloadJob, 1);
+                job->info = g_object_ref (info);
+                g_hash_table_insert (preloader.jobs, info, job);
+                g_thread_pool_push (preloader.pool, job, NULL);
+        }
+
+        for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                preload_wait (&preloader, l->data);
+                maybe_activate_plugin (l->data, manager);
+        }
+
+        g_thread_pool_free (preloader.pool, FALSE, TRUE);
+        g_hash_table_destroy (preloader.jobs);
+        g_cond_clear (&preloader.cond);
+        g_mutex_clear (&preloader.lock);
+
+        mate_settings_profile_end (NULL);
+}
+
 static void
 on_plugin_activated (MateSettingsPluginInfo *info,
                      MateSettingsManager    *manager)
@@ -163,38 +621,65 @@ on_plugin_deactivated (MateSettingsPluginInfo *info,
         g_signal_emit (manager, signals [PLUGIN_DEACTIVATED], 0, name);
 }
 
-static gboolean
-is_item_in_schema (char       **items,
-                   const char  *item)
+static void
+add_schemas_to_index (GHashTable  *index,
+                      gchar      **schemas)
 {
-	while (*items) {
-	       if (g_strcmp0 (*items++, item) == 0)
-		       return TRUE;
-	}
-	return FALSE;
+        gchar **p;
+
+        /* the index takes over the strings */
+        for (p = schemas; *p != NULL; p++)
+                g_hash_table_add (index, *p);
+        g_free (schemas);
 }
 
-static gboolean
-is_schema (const char *schema)
+/* All installed schema ids, listed once instead of for every plugin */
+static GHashTable *
+schema_index_new (void)
 {
-        GSettingsSchemaSource *source = NULL;
+        GSettingsSchemaSource *source;
+        GHashTable *index;
         gchar **non_relocatable = NULL;
         gchar **relocatable = NULL;
-        gboolean in_schema;
+
+        mate_settings_profile_start (NULL);
+
+        index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
         source = g_settings_schema_source_get_default ();
-        if (!source)
-                return FALSE;
+        if (source) {
+                g_settings_schema_source_list_schemas (source, TRUE, &non_relocatable, &relocatable);
+                add_schemas_to_index (index, non_relocatable);
+                add_schemas_to_index (index, relocatable);
+        }
+
+        g_debug ("Indexed %u schemas", g_hash_table_size (index));
+
+        mate_settings_profile_end (NULL);
+
+        return index;
+}
 
-        g_settings_schema_source_list_schemas (source, TRUE, &non_relocatable, &relocatable);
+static gboolean
+is_schema (MateSettingsManager *manager,
+           const char          *schema)
+{
+        GSettingsSchemaSource *source;
+        GSettingsSchema *found;
 
-        in_schema = (is_item_in_schema (non_relocatable, schema) ||
-                is_item_in_schema (relocatable, schema));
+        if (manager->priv->schema_index != NULL)
+                return g_hash_table_contains (manager->priv->schema_index, schema);
 
-        g_strfreev (non_relocatable);
-        g_strfreev (relocatable);
+        source = g_settings_schema_source_get_default ();
+        if (!source)
+                return FALSE;
 
-        return in_schema;
+        found = g_settings_schema_source_lookup (source, schema, TRUE);
+        if (found == NULL)
+                return FALSE;
+
+        g_settings_schema_unref (found);
+        return TRUE;
 }
 
 static void
@@ -225,7 +710,7 @@ _load_file (MateSettingsManager *manager,
                                   mate_settings_plugin_info_get_location (info));
 
 	/* Ignore unknown schemas or else we'll assert */
-	if (is_schema (schema)) {
+	if (is_schema (manager, schema)) {
 	       manager->priv->plugins = g_slist_prepend (manager->priv->plugins,
 		                                         g_object_ref (info));
 
@@ -293,11 +778,16 @@ _load_all (MateSettingsManager *manager)
 {
         mate_settings_profile_start (NULL);
 
+        manager->priv->schema_index = schema_index_new ();
+
         /* load system plugins */
         _load_dir (manager, MATE_SETTINGS_PLUGINDIR G_DIR_SEPARATOR_S);
 
+        g_clear_pointer (&manager->priv->schema_index, g_hash_table_destroy);
+
         manager->priv->plugins = g_slist_sort (manager->priv->plugins, (GCompareFunc) compare_priority);
-        g_slist_foreach (manager->priv->plugins, (GFunc) maybe_activate_plugin, manager);
+        order_by_requires (manager);
+        activate_plugins (manager);
         mate_settings_profile_end (NULL);
 }
 
@@ -313,6 +803,8 @@ _unload_plugin (MateSettingsPluginInfo *info, gpointer user_data)
 static void
 _unload_all (MateSettingsManager *manager)
 {
+         g_hash_table_remove_all (manager->priv->lazy_plugins);
+         g_hash_table_remove_all (manager->priv->load_priorities);
          g_slist_foreach (manager->priv->plugins, (GFunc) _unload_plugin, NULL);
          g_slist_free (manager->priv->plugins);
          manager->priv->plugins = NULL;
@@ -333,6 +825,42 @@ mate_settings_manager_awake (MateSettingsManager *manager,
         return mate_settings_manager_start (manager, PLUGIN_LOAD_ALL, error);
 }
 
+static gboolean
+activate_plugin_by_name (MateSettingsManager  *manager,
+                         const char           *name,
+                         GError              **error)
+{
+        MateSettingsPluginInfo *info;
+
+        info = find_plugin (manager, name);
+        if (info == NULL || !mate_settings_plugin_info_get_enabled (info)) {
+                g_set_error (error,
+                             MATE_SETTINGS_MANAGER_ERROR,
+                             MATE_SETTINGS_MANAGER_ERROR_GENERAL,
+                             "No enabled plugin named '%s'", name);
+                return FALSE;
+        }
+
+        /* other plugins are only started by their load pass */
+        if (!g_hash_table_contains (manager->priv->lazy_plugins, info)) {
+                g_set_error (error,
+                             MATE_SETTINGS_MANAGER_ERROR,
+                             MATE_SETTINGS_MANAGER_ERROR_GENERAL,
+                             "Plugin '%s' is not started on demand", name);
+                return FALSE;
+        }
+
+        if (!activate_with_requires (manager, info, NULL)) {
+                g_set_error (error,
+                             MATE_SETTINGS_MANAGER_ERROR,
+                             MATE_SETTINGS_MANAGER_ERROR_GENERAL,
+                             "Plugin '%s' could not be activated", name);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const gchar           *sender,
@@ -358,6 +886,21 @@ handle_method_call (GDBusConnection       *connection,
                         g_dbus_method_invocation_return_gerror (invocation, error);
                 else
                         g_dbus_method_invocation_return_value (invocation, NULL);
+        } else if (g_strcmp0 (method_name, "ActivatePlugin") == 0) {
+                const gchar *name;
+
+                g_variant_get (parameters, "(&s)", &name);
+                if (activate_plugin_by_name (manager, name, &error) == FALSE)
+                        g_dbus_method_invocation_return_gerror (invocation, error);
+                else
+                        g_dbus_method_invocation_return_value (invocation, NULL);
+        } else if (g_strcmp0 (method_name, "GetProfile") == 0) {
+                char *trace;
+
+                trace = mate_settings_profile_dump ();
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(s)", trace));
+                g_free (trace);
         }
 }
 
@@ -497,9 +1040,12 @@ mate_settings_manager_init (MateSettingsManager *manager)
         char      *schema;
 
         manager->priv = mate_settings_manager_get_instance_private (manager);
+        manager->priv->lazy_plugins = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                             NULL, (GDestroyNotify) lazy_plugin_free);
+        manager->priv->load_priorities = g_hash_table_new (g_direct_hash, g_direct_equal);
 
         schema = g_strdup_printf ("%s.plugins", DEFAULT_SETTINGS_PREFIX);
-        if (is_schema (schema)) {
+        if (is_schema (manager, schema)) {
                 GSettings *settings;
 
                 settings = g_settings_new (schema);
@@ -521,6 +1067,9 @@ mate_settings_manager_finalize (GObject *object)
 
         g_return_if_fail (manager->priv != NULL);
 
+        g_hash_table_destroy (manager->priv->lazy_plugins);
+        g_hash_table_destroy (manager->priv->load_priorities);
+
         G_OBJECT_CLASS (mate_settings_manager_parent_class)->finalize (object);
 }
 
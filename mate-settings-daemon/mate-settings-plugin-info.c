@@ -58,6 +58,8 @@ struct MateSettingsPluginInfoPrivate
         char                   **authors;
         char                    *copyright;
         char                    *website;
+        char                   **requires;
+        char                   **activate_on_names;
 
         MateSettingsPlugin      *plugin;
 
@@ -66,6 +68,11 @@ struct MateSettingsPluginInfoPrivate
         guint                    x11_only : 1;
         guint                    wayland_only : 1;
 
+        /* Lazy plugins are only activated when first needed, see
+         * ActivateOnName, and may be deactivated again once unused. */
+        guint                    lazy : 1;
+        int                      lazy_unload_timeout;
+
         /* A plugin is unavailable if it is not possible to activate it
            due to an error loading the plugin module */
         guint                    available : 1;
@@ -115,6 +122,8 @@ mate_settings_plugin_info_finalize (GObject *object)
         g_free (info->priv->website);
         g_free (info->priv->copyright);
         g_strfreev (info->priv->authors);
+        g_strfreev (info->priv->requires);
+        g_strfreev (info->priv->activate_on_names);
 
 	if (info->priv->settings != NULL) {
 		g_object_unref (info->priv->settings);
@@ -249,6 +258,9 @@ mate_settings_plugin_info_fill_from_file (MateSettingsPluginInfo *info,
                 g_debug ("Could not find 'Website' in %s", filename);
         }
 
+        /* Get Requires */
+        info->priv->requires = g_key_file_get_string_list (plugin_file, PLUGIN_GROUP, "Requires", NULL, NULL);
+
         /* Get Priority */
         priority = g_key_file_get_integer (plugin_file, PLUGIN_GROUP, "Priority", NULL);
         if (priority >= PLUGIN_PRIORITY_MAX) {
@@ -265,6 +277,18 @@ mate_settings_plugin_info_fill_from_file (MateSettingsPluginInfo *info,
         info->priv->wayland_only =
                 g_key_file_get_boolean (plugin_file, PLUGIN_GROUP, "WaylandOnly", NULL);
 
+        /* Get Lazy */
+        info->priv->lazy =
+                g_key_file_get_boolean (plugin_file, PLUGIN_GROUP, "Lazy", NULL);
+
+        /* Get ActivateOnName */
+        info->priv->activate_on_names =
+                g_key_file_get_string_list (plugin_file, PLUGIN_GROUP, "ActivateOnName", NULL, NULL);
+
+        /* Get LazyUnloadTimeout */
+        info->priv->lazy_unload_timeout =
+                MAX (g_key_file_get_integer (plugin_file, PLUGIN_GROUP, "LazyUnloadTimeout", NULL), 0);
+
         g_key_file_free (plugin_file);
 
         debug_info (info);
@@ -333,11 +357,23 @@ mate_settings_plugin_info_deactivate (MateSettingsPluginInfo *info)
         return TRUE;
 }
 
+static char *
+build_module_path (MateSettingsPluginInfo *info)
+{
+        char *dirname;
+        char *path;
+
+        dirname = g_path_get_dirname (info->priv->file);
+        path = g_module_build_path (dirname, info->priv->location);
+        g_free (dirname);
+
+        return path;
+}
+
 static gboolean
 load_plugin_module (MateSettingsPluginInfo *info)
 {
         char    *path;
-        char    *dirname;
         gboolean ret;
 
         ret = FALSE;
@@ -350,11 +386,7 @@ load_plugin_module (MateSettingsPluginInfo *info)
 
         mate_settings_profile_start ("%s", info->priv->location);
 
-        dirname = g_path_get_dirname (info->priv->file);
-        g_return_val_if_fail (dirname != NULL, FALSE);
-
-        path = g_module_build_path (dirname, info->priv->location);
-        g_free (dirname);
+        path = build_module_path (info);
         g_return_val_if_fail (path != NULL, FALSE);
 
         info->priv->module = G_TYPE_MODULE (mate_settings_module_new (path));
@@ -408,19 +440,32 @@ _activate_plugin (MateSettingsPluginInfo *info)
         return res;
 }
 
-gboolean
-mate_settings_plugin_info_activate (MateSettingsPluginInfo *info)
+/* Maps the plugin's shared object without registering its types.  This
+ * may be called from any thread; the returned handle only keeps the
+ * library resident so that activating the plugin later does not pay for
+ * the dlopen.  Release it with g_module_close(). */
+GModule *
+mate_settings_plugin_info_open_module (MateSettingsPluginInfo *info)
 {
+        GModule *library;
+        char    *path;
 
-        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), FALSE);
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), NULL);
 
-        if (! info->priv->available) {
-                return FALSE;
+        path = build_module_path (info);
+        library = g_module_open (path, 0);
+        if (library == NULL) {
+                g_debug ("Could not preload '%s': %s", path, g_module_error ());
         }
+        g_free (path);
 
-        if (info->priv->active) {
-                return TRUE;
-        }
+        return library;
+}
+
+gboolean
+mate_settings_plugin_info_supports_display (MateSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), FALSE);
 
         if (info->priv->x11_only) {
 #ifdef GDK_WINDOWING_X11
@@ -448,6 +493,27 @@ mate_settings_plugin_info_activate (MateSettingsPluginInfo *info)
                 }
         }
 
+        return TRUE;
+}
+
+gboolean
+mate_settings_plugin_info_activate (MateSettingsPluginInfo *info)
+{
+
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), FALSE);
+
+        if (! info->priv->available) {
+                return FALSE;
+        }
+
+        if (info->priv->active) {
+                return TRUE;
+        }
+
+        if (!mate_settings_plugin_info_supports_display (info)) {
+                return FALSE;
+        }
+
         if (_activate_plugin (info)) {
                 info->priv->active = TRUE;
                 return TRUE;
@@ -488,6 +554,30 @@ mate_settings_plugin_info_get_wayland_only (MateSettingsPluginInfo *info)
         return (info->priv->wayland_only);
 }
 
+gboolean
+mate_settings_plugin_info_get_lazy (MateSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), FALSE);
+
+        return (info->priv->lazy);
+}
+
+const char **
+mate_settings_plugin_info_get_activate_on_names (MateSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), (const char **)NULL);
+
+        return (const char **)info->priv->activate_on_names;
+}
+
+int
+mate_settings_plugin_info_get_lazy_unload_timeout (MateSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), 0);
+
+        return info->priv->lazy_unload_timeout;
+}
+
 gboolean
 mate_settings_plugin_info_is_available (MateSettingsPluginInfo *info)
 {
@@ -536,6 +626,14 @@ mate_settings_plugin_info_get_copyright (MateSettingsPluginInfo *info)
         return info->priv->copyright;
 }
 
+const char **
+mate_settings_plugin_info_get_requires (MateSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (MATE_IS_SETTINGS_PLUGIN_INFO (info), (const char **)NULL);
+
+        return (const char **)info->priv->requires;
+}
+
 const char *
 mate_settings_plugin_info_get_location (MateSettingsPluginInfo *info)
 {
@@ -57,18 +57,24 @@ MateSettingsPluginInfo *mate_settings_plugin_info_new_from_file (const char *fil
 
 gboolean         mate_settings_plugin_info_activate        (MateSettingsPluginInfo *info);
 gboolean         mate_settings_plugin_info_deactivate      (MateSettingsPluginInfo *info);
+GModule         *mate_settings_plugin_info_open_module     (MateSettingsPluginInfo *info);
+gboolean         mate_settings_plugin_info_supports_display (MateSettingsPluginInfo *info);
 
 gboolean         mate_settings_plugin_info_is_active       (MateSettingsPluginInfo *info);
 gboolean         mate_settings_plugin_info_get_enabled     (MateSettingsPluginInfo *info);
 gboolean         mate_settings_plugin_info_is_available    (MateSettingsPluginInfo *info);
 gboolean         mate_settings_plugin_info_get_x11_only    (MateSettingsPluginInfo *info);
 gboolean         mate_settings_plugin_info_get_wayland_only (MateSettingsPluginInfo *info);
+gboolean         mate_settings_plugin_info_get_lazy        (MateSettingsPluginInfo *info);
+const char     **mate_settings_plugin_info_get_activate_on_names (MateSettingsPluginInfo *info);
+int              mate_settings_plugin_info_get_lazy_unload_timeout (MateSettingsPluginInfo *info);
 
 const char      *mate_settings_plugin_info_get_name        (MateSettingsPluginInfo *info);
 const char      *mate_settings_plugin_info_get_description (MateSettingsPluginInfo *info);
 const char     **mate_settings_plugin_info_get_authors     (MateSettingsPluginInfo *info);
 const char      *mate_settings_plugin_info_get_website     (MateSettingsPluginInfo *info);
 const char      *mate_settings_plugin_info_get_copyright   (MateSettingsPluginInfo *info);
+const char     **mate_settings_plugin_info_get_requires    (MateSettingsPluginInfo *info);
 const char      *mate_settings_plugin_info_get_location    (MateSettingsPluginInfo *info);
 int              mate_settings_plugin_info_get_priority    (MateSettingsPluginInfo *info);
 
@@ -35,32 +35,290 @@
 
 #include "mate-settings-profile.h"
 
+/* Marks are recorded into one ring buffer per thread.  Only the owning
+ * thread writes to a ring and publishes each record by advancing @head,
+ * so logging takes no lock and allocates nothing once the thread has its
+ * ring.  Readers copy a ring and then drop whatever the writer may have
+ * overwritten meanwhile.  Rings of exited threads are kept, with their
+ * records, and handed to the next new thread under a new thread id;
+ * each record carries the id of the thread that wrote it. */
+
+#define RING_SIZE 1024  /* records per thread, a power of two */
+#define NOTE_SIZE 48
+
+typedef struct {
+        gint64      time;
+        guint       tid;
+        const char *func;
+        char        phase;
+        char        note[NOTE_SIZE];
+} ProfileRecord;
+
+typedef struct _ProfileRing ProfileRing;
+
+struct _ProfileRing {
+        ProfileRing   *next;
+        guint          tid;
+        volatile gint  in_use;
+        volatile gint  head;
+        ProfileRecord  records[RING_SIZE];
+};
+
+static ProfileRing *rings = NULL;
+static volatile gint n_threads = 0;
+
+static void
+ring_release (ProfileRing *ring)
+{
+        g_atomic_int_set (&ring->in_use, 0);
+}
+
+static GPrivate ring_key = G_PRIVATE_INIT ((GDestroyNotify) ring_release);
+
+static ProfileRing *
+get_ring (void)
+{
+        ProfileRing *ring;
+
+        ring = g_private_get (&ring_key);
+        if (ring != NULL)
+                return ring;
+
+        for (ring = g_atomic_pointer_get (&rings); ring != NULL; ring = ring->next) {
+                if (g_atomic_int_compare_and_exchange (&ring->in_use, 0, 1)) {
+                        ring->tid = g_atomic_int_add (&n_threads, 1) + 1;
+                        break;
+                }
+        }
+
+        if (ring == NULL) {
+                ring = g_new0 (ProfileRing, 1);
+                ring->in_use = 1;
+                ring->tid = g_atomic_int_add (&n_threads, 1) + 1;
+                do {
+                        ring->next = g_atomic_pointer_get (&rings);
+                } while (!g_atomic_pointer_compare_and_exchange (&rings, ring->next, ring));
+        }
+
+        g_private_set (&ring_key, ring);
+
+        return ring;
+}
+
+static gboolean
+strace_marks_enabled (void)
+{
+        static gsize enabled = 0;
+
+        if (g_once_init_enter (&enabled)) {
+                gboolean set = g_getenv ("MATE_SETTINGS_PROFILE_STRACE") != NULL;
+                g_once_init_leave (&enabled, set ? 2 : 1);
+        }
+
+        return enabled == 2;
+}
+
+/* The old way of exposing marks: a failing access() that shows up in
+ * strace output. */
+static void
+log_strace_mark (const char *func,
+                 const char *note,
+                 const char *formatted)
+{
+        char *str;
+
+        if (func != NULL) {
+                str = g_strdup_printf ("MARK: %s %s: %s %s", g_get_prgname(), func, note ? note : "", formatted);
+        } else {
+                str = g_strdup_printf ("MARK: %s: %s %s", g_get_prgname(), note ? note : "", formatted);
+        }
+
+        g_access (str, F_OK);
+        g_free (str);
+}
+
 void
 _mate_settings_profile_log (const char *func,
                              const char *note,
                              const char *format,
                              ...)
 {
-        va_list args;
-        char   *str;
-        char   *formatted;
+        ProfileRing   *ring;
+        ProfileRecord *record;
+        va_list        args;
+        gint           head;
+
+        ring = get_ring ();
+        head = g_atomic_int_get (&ring->head);
+        record = &ring->records[(guint) head & (RING_SIZE - 1)];
+
+        record->time = g_get_monotonic_time ();
+        record->tid = ring->tid;
+        record->func = func;
+        if (g_strcmp0 (note, "start") == 0)
+                record->phase = 'B';
+        else if (g_strcmp0 (note, "end") == 0)
+                record->phase = 'E';
+        else
+                record->phase = 'i';
 
         if (format == NULL) {
-                formatted = g_strdup ("");
+                record->note[0] = '\0';
         } else {
                 va_start (args, format);
-                formatted = g_strdup_vprintf (format, args);
+                g_vsnprintf (record->note, NOTE_SIZE, format, args);
                 va_end (args);
         }
 
-        if (func != NULL) {
-                str = g_strdup_printf ("MARK: %s %s: %s %s", g_get_prgname(), func, note ? note : "", formatted);
-        } else {
-                str = g_strdup_printf ("MARK: %s: %s %s", g_get_prgname(), note ? note : "", formatted);
+        g_atomic_int_set (&ring->head, head + 1);
+
+        if (strace_marks_enabled ())
+                log_strace_mark (func, note, record->note);
+}
+
+static void
+append_json_string (GString    *str,
+                    const char *value)
+{
+        g_string_append_c (str, '"');
+        for (; *value != '\0'; value++) {
+                guchar c = *value;
+
+                if (c == '"' || c == '\\')
+                        g_string_append_printf (str, "\\%c", c);
+                else if (c < 0x20)
+                        g_string_append_printf (str, "\\u%04x", c);
+                else
+                        g_string_append_c (str, c);
         }
+        g_string_append_c (str, '"');
+}
 
-        g_free (formatted);
+static gboolean
+record_owner_exited (ProfileRing *ring,
+                     guint        tid)
+{
+        return !g_atomic_int_get (&ring->in_use) || ring->tid != tid;
+}
 
-        g_access (str, F_OK);
-        g_free (str);
+static void
+append_event (GString    *str,
+              const char *name,
+              char        phase,
+              gint64      time,
+              guint       tid,
+              gboolean   *first)
+{
+        g_string_append (str, *first ? "\n" : ",\n");
+        *first = FALSE;
+
+        g_string_append (str, "{\"name\":");
+        append_json_string (str, name);
+        g_string_append_printf (str,
+                                ",\"cat\":\"msd\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u%s}",
+                                phase, time, (int) getpid (), tid,
+                                phase == 'i' ? ",\"s\":\"t\"" : "");
+}
+
+/* Ends the slices a thread left open when it exited, so that they do
+ * not swallow the rest of the trace */
+static void
+close_open_events (GString      *str,
+                   GPtrArray    *open,
+                   gint64        time,
+                   guint         tid,
+                   gboolean     *first)
+{
+        while (open->len > 0) {
+                append_event (str, g_ptr_array_index (open, open->len - 1), 'E', time, tid, first);
+                g_ptr_array_remove_index (open, open->len - 1);
+        }
+}
+
+static void
+append_ring_events (GString     *str,
+                    ProfileRing *ring,
+                    gboolean    *first)
+{
+        ProfileRecord *copy;
+        guint          head;
+        guint          tail;
+        guint          i;
+        GPtrArray     *open;
+        gint64         last_time = 0;
+        guint          last_tid = 0;
+
+        copy = g_new (ProfileRecord, RING_SIZE);
+        open = g_ptr_array_new_with_free_func (g_free);
+
+        head = (guint) g_atomic_int_get (&ring->head);
+        memcpy (copy, ring->records, sizeof (ring->records));
+
+        /* the writer may have reused slots while we were copying */
+        tail = (guint) g_atomic_int_get (&ring->head);
+        tail = tail >= RING_SIZE ? tail - RING_SIZE + 1 : 0;
+
+        for (i = tail; (gint) (head - i) > 0; i++) {
+                ProfileRecord *record = &copy[i & (RING_SIZE - 1)];
+                char          *name;
+
+                if (record->tid != last_tid)
+                        close_open_events (str, open, last_time, last_tid, first);
+
+                if (record->note[0] != '\0')
+                        name = g_strdup_printf ("%s %s", record->func ? record->func : "mark", record->note);
+                else
+                        name = g_strdup (record->func ? record->func : "mark");
+
+                append_event (str, name, record->phase, record->time, record->tid, first);
+
+                if (record->phase == 'B') {
+                        g_ptr_array_add (open, name);
+                } else {
+                        if (record->phase == 'E' && open->len > 0)
+                                g_ptr_array_remove_index (open, open->len - 1);
+                        g_free (name);
+                }
+
+                last_time = record->time;
+                last_tid = record->tid;
+        }
+
+        /* the last thread of the ring may still be running */
+        if (record_owner_exited (ring, last_tid))
+                close_open_events (str, open, last_time, last_tid, first);
+
+        g_ptr_array_free (open, TRUE);
+        g_free (copy);
+}
+
+/* Returns the recorded marks of all threads as Chrome trace-event JSON,
+ * which can be loaded in chrome://tracing or Perfetto. */
+char *
+mate_settings_profile_dump (void)
+{
+        GString     *str;
+        ProfileRing *ring;
+        gboolean     first = TRUE;
+
+        str = g_string_new ("{\"traceEvents\":[");
+        for (ring = g_atomic_pointer_get (&rings); ring != NULL; ring = ring->next)
+                append_ring_events (str, ring, &first);
+        g_string_append (str, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+        return g_string_free (str, FALSE);
+}
+
+gboolean
+mate_settings_profile_write (const char  *filename,
+                             GError     **error)
+{
+        char     *json;
+        gboolean  ret;
+
+        json = mate_settings_profile_dump ();
+        ret = g_file_set_contents (filename, json, -1, error);
+        g_free (json);
+
+        return ret;
 }
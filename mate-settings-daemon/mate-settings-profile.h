@@ -51,6 +51,10 @@ void            _mate_settings_profile_log    (const char *func,
                                                 const char *format,
                                                 ...) G_GNUC_PRINTF (3, 4);
 
+char           *mate_settings_profile_dump    (void);
+gboolean        mate_settings_profile_write   (const char  *filename,
+                                               GError     **error);
+
 #ifdef __cplusplus
 }
 #endif
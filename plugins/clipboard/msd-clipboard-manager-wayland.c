@@ -18,12 +18,18 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "config.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#endif
 
 #include <glib.h>
 #include <glib-unix.h>
@@ -39,10 +45,30 @@ typedef enum
         MSD_WAYLAND_SELECTION_PRIMARY
 } SelectionKind;
 
+#define CLIPBOARD_SCHEMA        "org.mate.SettingsDaemon.plugins.clipboard"
+#define KEY_MEMFD_THRESHOLD     "memfd-threshold"
+
+/* Size of a single read() or splice() from the source application. */
+#define RECEIVE_CHUNK_SIZE      (64 * 1024)
+
+/* A cached selection payload. Small payloads live on the heap; once a
+ * receive grows past the memfd threshold the data is moved to a sealed
+ * memfd, which is filled with splice() and served with sendfile() so
+ * large images never pass through our own buffers. */
 typedef struct
 {
-        gchar      *mime;
-        GByteArray *data;
+        gint        ref_count;
+        GBytes     *bytes;
+        gint        fd;
+        gsize       size;
+        guint       hash;
+        gboolean    has_hash;
+} ClipPayload;
+
+typedef struct
+{
+        gchar       *mime;
+        ClipPayload *payload;
 } ClipEntry;
 
 typedef struct _MsdClipboardManagerWayland MsdClipboardManagerWayland;
@@ -55,9 +81,27 @@ typedef struct
         guint                       source_id;
         gchar                      *mime;
         GByteArray                 *data;
+        gint                        memfd;
+        gsize                       memfd_size;
         gboolean                    done;
+        gboolean                    dropped;
 } ClipReceive;
 
+/* One outstanding paste: the consumer's pipe is drained from the main
+ * loop whenever it becomes writable, so a slow reader only delays
+ * itself.  The payload is referenced, not copied, so it stays valid if
+ * the cache is replaced while the send is still in flight. */
+typedef struct
+{
+        MsdClipboardManagerWayland *wl;
+        gint                        fd;
+        guint                       source_id;
+        guint                       stall_timeout;
+        ClipPayload                *payload;
+        gsize                       offset;
+        gint64                      last_progress_ms;
+} ClipSend;
+
 typedef struct
 {
         MsdClipboardManagerWayland           *wl;
@@ -69,6 +113,11 @@ typedef struct
         gboolean                              reoffer_pending;
         guint                                 reoffer_timeout;
         gint64                                last_activity_ms;
+        gsize                                 shared_bytes;
+        gsize                                 cache_size;
+        GPtrArray                            *deferred_mimes;
+        guint                                 deferred_timeout;
+        gboolean                              receiving_deferred;
 } SelectionState;
 
 struct _MsdClipboardManagerWayland
@@ -85,10 +134,259 @@ struct _MsdClipboardManagerWayland
 
         SelectionState                       clipboard;
         SelectionState                       primary;
+
+        GPtrArray                           *sends;
+
+        GSettings                           *settings;
+        gsize                                memfd_threshold;
+
+        /* Debug counter: bytes not held twice thanks to payload sharing,
+         * summed over every selection cached so far. */
+        guint64                              total_shared_bytes;
 };
 
 static void    selection_state_clear      (SelectionState *state);
 
+/* Not every offered type is worth copying out of the source application
+ * up front.  Text, file lists and the best image type are fetched as soon
+ * as a selection appears; the rest are fetched one at a time once the
+ * selection has settled, in table order, and only while the cache stays
+ * under CACHE_BUDGET_BYTES.  If the selection changes first, they are
+ * never transferred at all. */
+#define DEFERRED_FETCH_DELAY_MS 1000
+#define CACHE_BUDGET_BYTES      (64 * 1024 * 1024)
+
+typedef enum
+{
+        MIME_CLASS_TEXT,
+        MIME_CLASS_FILES,
+        MIME_CLASS_IMAGE,
+        MIME_CLASS_OTHER,
+        MIME_CLASS_IGNORE
+} MimeClass;
+
+static const struct {
+        const gchar *mime;
+        MimeClass    mime_class;
+} mime_priorities[] = {
+        { "text/plain;charset=utf-8",     MIME_CLASS_TEXT   },
+        { "UTF8_STRING",                  MIME_CLASS_TEXT   },
+        { "text/plain",                   MIME_CLASS_TEXT   },
+        { "STRING",                       MIME_CLASS_TEXT   },
+        { "TEXT",                         MIME_CLASS_TEXT   },
+        { "COMPOUND_TEXT",                MIME_CLASS_TEXT   },
+        { "text/uri-list",                MIME_CLASS_FILES  },
+        { "x-special/gnome-copied-files", MIME_CLASS_FILES  },
+        { "x-special/mate-copied-files",  MIME_CLASS_FILES  },
+        { "image/png",                    MIME_CLASS_IMAGE  },
+        { "image/jpeg",                   MIME_CLASS_IMAGE  },
+        { "image/bmp",                    MIME_CLASS_IMAGE  },
+        { "image/tiff",                   MIME_CLASS_IMAGE  },
+        { "image/gif",                    MIME_CLASS_IMAGE  },
+        { "text/html",                    MIME_CLASS_OTHER  },
+        { "text/rtf",                     MIME_CLASS_OTHER  },
+        { "TARGETS",                      MIME_CLASS_IGNORE },
+        { "MULTIPLE",                     MIME_CLASS_IGNORE },
+        { "TIMESTAMP",                    MIME_CLASS_IGNORE },
+        { "SAVE_TARGETS",                 MIME_CLASS_IGNORE },
+        { "DELETE",                       MIME_CLASS_IGNORE },
+};
+
+/* Lower is more important. */
+static guint
+mime_get_priority (const gchar *mime,
+                   MimeClass   *mime_class)
+{
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (mime_priorities); i++) {
+                if (g_ascii_strcasecmp (mime, mime_priorities[i].mime) == 0) {
+                        *mime_class = mime_priorities[i].mime_class;
+                        return i;
+                }
+        }
+
+        if (g_str_has_prefix (mime, "image/")) {
+                *mime_class = MIME_CLASS_IMAGE;
+                return i;
+        }
+
+        *mime_class = MIME_CLASS_OTHER;
+        if (g_str_has_prefix (mime, "text/"))
+                return i + 1;
+
+        return i + 2;
+}
+
+static gint
+compare_mime_priority (gconstpointer a,
+                       gconstpointer b)
+{
+        MimeClass mime_class;
+        guint     priority_a;
+        guint     priority_b;
+
+        priority_a = mime_get_priority (*(const gchar **) a, &mime_class);
+        priority_b = mime_get_priority (*(const gchar **) b, &mime_class);
+
+        return (priority_a > priority_b) - (priority_a < priority_b);
+}
+
+/* Splits the offered types into those fetched right away and those
+ * deferred, the latter sorted by priority. */
+static void
+partition_mimes (GPtrArray *mimes,
+                 GPtrArray *eager,
+                 GPtrArray *deferred)
+{
+        const gchar *best_image = NULL;
+        guint        best_image_priority = G_MAXUINT;
+        guint        i;
+
+        for (i = 0; i < mimes->len; i++) {
+                MimeClass mime_class;
+                guint     priority;
+
+                priority = mime_get_priority (mimes->pdata[i], &mime_class);
+                if (mime_class == MIME_CLASS_IMAGE && priority < best_image_priority) {
+                        best_image = mimes->pdata[i];
+                        best_image_priority = priority;
+                }
+        }
+
+        for (i = 0; i < mimes->len; i++) {
+                const gchar *mime = mimes->pdata[i];
+                MimeClass    mime_class;
+
+                mime_get_priority (mime, &mime_class);
+                switch (mime_class) {
+                case MIME_CLASS_TEXT:
+                case MIME_CLASS_FILES:
+                        g_ptr_array_add (eager, g_strdup (mime));
+                        break;
+                case MIME_CLASS_IMAGE:
+                        g_ptr_array_add (mime == best_image ? eager : deferred, g_strdup (mime));
+                        break;
+                case MIME_CLASS_OTHER:
+                        g_ptr_array_add (deferred, g_strdup (mime));
+                        break;
+                case MIME_CLASS_IGNORE:
+                        break;
+                }
+        }
+
+        /* Nothing we know how to rank: keep whatever the source offers. */
+        if (eager->len == 0) {
+                for (i = 0; i < deferred->len; i++)
+                        g_ptr_array_add (eager, g_strdup (deferred->pdata[i]));
+                g_ptr_array_set_size (deferred, 0);
+        }
+
+        g_ptr_array_sort (deferred, compare_mime_priority);
+}
+
+static ClipPayload *
+clip_payload_new (GBytes *bytes,
+                  gint    fd,
+                  gsize   size)
+{
+        ClipPayload *payload;
+
+        payload = g_new0 (ClipPayload, 1);
+        payload->ref_count = 1;
+        payload->bytes = bytes;
+        payload->fd = fd;
+        payload->size = size;
+
+        return payload;
+}
+
+static ClipPayload *
+clip_payload_ref (ClipPayload *payload)
+{
+        payload->ref_count++;
+        return payload;
+}
+
+static void
+clip_payload_unref (ClipPayload *payload)
+{
+        if (--payload->ref_count > 0)
+                return;
+
+        if (payload->bytes != NULL)
+                g_bytes_unref (payload->bytes);
+        if (payload->fd != -1)
+                close (payload->fd);
+        g_free (payload);
+}
+
+/* Returns the payload contents; memfd-backed payloads are mapped. */
+static GBytes *
+clip_payload_get_bytes (ClipPayload *payload)
+{
+        GMappedFile *mapped;
+        GBytes      *bytes;
+
+        if (payload->bytes != NULL)
+                return g_bytes_ref (payload->bytes);
+
+        mapped = g_mapped_file_new_from_fd (payload->fd, FALSE, NULL);
+        if (mapped == NULL)
+                return NULL;
+
+        bytes = g_mapped_file_get_bytes (mapped);
+        g_mapped_file_unref (mapped);
+
+        return bytes;
+}
+
+static guint
+clip_payload_hash (ClipPayload *payload)
+{
+        GBytes *bytes;
+
+        if (payload->has_hash)
+                return payload->hash;
+
+        bytes = clip_payload_get_bytes (payload);
+        if (bytes == NULL)
+                return 0;
+
+        payload->hash = g_bytes_hash (bytes);
+        payload->has_hash = TRUE;
+        g_bytes_unref (bytes);
+
+        return payload->hash;
+}
+
+static gboolean
+clip_payload_equal (ClipPayload *a,
+                    ClipPayload *b)
+{
+        GBytes   *bytes_a;
+        GBytes   *bytes_b;
+        gboolean  equal;
+
+        /* Sizes are compared first so that only colliding payloads are
+         * ever hashed, and the hash first so that only likely duplicates
+         * are compared byte by byte. */
+        if (a->size != b->size)
+                return FALSE;
+        if (clip_payload_hash (a) != clip_payload_hash (b) || !a->has_hash || !b->has_hash)
+                return FALSE;
+
+        bytes_a = clip_payload_get_bytes (a);
+        bytes_b = clip_payload_get_bytes (b);
+        equal = bytes_a != NULL && bytes_b != NULL && g_bytes_equal (bytes_a, bytes_b);
+        if (bytes_a != NULL)
+                g_bytes_unref (bytes_a);
+        if (bytes_b != NULL)
+                g_bytes_unref (bytes_b);
+
+        return equal;
+}
+
 static void
 clip_entry_free (gpointer data)
 {
@@ -98,8 +396,8 @@ clip_entry_free (gpointer data)
                 return;
 
         g_free (entry->mime);
-        if (entry->data != NULL)
-                g_byte_array_free (entry->data, TRUE);
+        if (entry->payload != NULL)
+                clip_payload_unref (entry->payload);
         g_free (entry);
 }
 
@@ -115,6 +413,9 @@ state_from_kind (MsdClipboardManagerWayland *wl,
 
 static void
 start_reoffer (SelectionState *state);
+static void
+schedule_deferred_fetch (SelectionState *state,
+                         guint           delay_ms);
 
 #define REOFFER_WINDOW_MS 2000
 #define REOFFER_QUIET_MS  1000
@@ -172,35 +473,112 @@ schedule_reoffer (SelectionState *state)
         }
 }
 
+static ClipPayload *
+receive_steal_payload (ClipReceive *recv)
+{
+        ClipPayload *payload;
+        GBytes      *bytes;
+
+        if (recv->memfd != -1) {
+#ifdef HAVE_MEMFD_CREATE
+                fcntl (recv->memfd, F_ADD_SEALS,
+                       F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+                payload = clip_payload_new (NULL, recv->memfd, recv->memfd_size);
+                recv->memfd = -1;
+                return payload;
+        }
+
+        bytes = g_byte_array_free_to_bytes (recv->data);
+        recv->data = NULL;
+
+        return clip_payload_new (bytes, -1, g_bytes_get_size (bytes));
+}
+
 static void
 finalize_cache (SelectionState *state)
 {
         GPtrArray *new_cache;
+        GPtrArray *unique;
+        gboolean   append;
+        gsize      shared_before;
         guint      i;
+        guint      shared = 0;
 
         if (state->receives == NULL)
                 return;
 
-        new_cache = g_ptr_array_new_with_free_func (clip_entry_free);
+        /* Deferred types are added to the cache of the same selection
+         * rather than replacing it. */
+        append = state->receiving_deferred && state->cache != NULL;
+        state->receiving_deferred = FALSE;
+
+        unique = g_ptr_array_new ();
+        if (append) {
+                new_cache = state->cache;
+                for (i = 0; i < new_cache->len; i++) {
+                        ClipEntry *entry = new_cache->pdata[i];
+
+                        if (!g_ptr_array_find (unique, entry->payload, NULL))
+                                g_ptr_array_add (unique, entry->payload);
+                }
+        } else {
+                new_cache = g_ptr_array_new_with_free_func (clip_entry_free);
+                state->shared_bytes = 0;
+        }
+        shared_before = state->shared_bytes;
 
         for (i = 0; i < state->receives->len; i++) {
                 ClipReceive *recv;
                 ClipEntry   *entry;
+                guint        j;
 
                 recv = state->receives->pdata[i];
+                if (recv->dropped)
+                        continue;
 
                 entry = g_new0 (ClipEntry, 1);
                 entry->mime = recv->mime;
-                entry->data = recv->data;
+                entry->payload = receive_steal_payload (recv);
                 recv->mime = NULL;
-                recv->data = NULL;
+
+                /* Applications commonly offer the same text under several
+                 * aliases (text/plain, UTF8_STRING, TEXT, STRING, ...);
+                 * keep a single copy and let the aliases share it. */
+                for (j = 0; j < unique->len; j++) {
+                        ClipPayload *other = unique->pdata[j];
+
+                        if (clip_payload_equal (entry->payload, other)) {
+                                clip_payload_unref (entry->payload);
+                                entry->payload = clip_payload_ref (other);
+                                state->shared_bytes += other->size;
+                                shared++;
+                                break;
+                        }
+                }
+                if (j == unique->len)
+                        g_ptr_array_add (unique, entry->payload);
 
                 g_ptr_array_add (new_cache, entry);
         }
 
-        if (state->cache != NULL)
-                g_ptr_array_free (state->cache, TRUE);
-        state->cache = new_cache;
+        state->cache_size = 0;
+        for (i = 0; i < unique->len; i++)
+                state->cache_size += ((ClipPayload *) unique->pdata[i])->size;
+        g_ptr_array_free (unique, TRUE);
+
+        state->wl->total_shared_bytes += state->shared_bytes - shared_before;
+        if (shared > 0)
+                g_debug ("Clipboard manager: %u of %u MIME types share data, "
+                         "saving %" G_GSIZE_FORMAT " bytes (%" G_GUINT64_FORMAT " in total)",
+                         shared, new_cache->len,
+                         state->shared_bytes, state->wl->total_shared_bytes);
+
+        if (!append) {
+                if (state->cache != NULL)
+                        g_ptr_array_free (state->cache, TRUE);
+                state->cache = new_cache;
+        }
 
         for (i = 0; i < state->receives->len; i++) {
                 ClipReceive *recv;
@@ -208,6 +586,10 @@ finalize_cache (SelectionState *state)
                 recv = state->receives->pdata[i];
                 if (recv->fd != -1)
                         close (recv->fd);
+                if (recv->data != NULL)
+                        g_byte_array_free (recv->data, TRUE);
+                if (recv->memfd != -1)
+                        close (recv->memfd);
                 g_free (recv);
         }
         g_ptr_array_free (state->receives, FALSE);
@@ -218,6 +600,7 @@ static void
 receive_finish (ClipReceive *recv)
 {
         SelectionState *state;
+        gboolean        deferred;
         guint           i;
 
         if (recv->done)
@@ -242,14 +625,26 @@ receive_finish (ClipReceive *recv)
                         return;
         }
 
+        deferred = state->receiving_deferred;
         finalize_cache (state);
 
         if (state->reoffer_pending) {
                 state->reoffer_pending = FALSE;
                 schedule_reoffer (state);
+        } else {
+                schedule_deferred_fetch (state, deferred ? 0 : DEFERRED_FETCH_DELAY_MS);
         }
 }
 
+static gsize
+receive_get_size (ClipReceive *recv)
+{
+        if (recv->memfd != -1)
+                return recv->memfd_size;
+
+        return recv->data != NULL ? recv->data->len : 0;
+}
+
 static void
 receive_cancel (ClipReceive *recv)
 {
@@ -260,22 +655,132 @@ receive_cancel (ClipReceive *recv)
         g_free (recv->mime);
         if (recv->data != NULL)
                 g_byte_array_free (recv->data, TRUE);
+        if (recv->memfd != -1)
+                close (recv->memfd);
         g_free (recv);
 }
 
+#ifdef HAVE_MEMFD_CREATE
+static gboolean
+write_all (gint          fd,
+           const guint8 *data,
+           gsize         len)
+{
+        while (len > 0) {
+                gssize n;
+
+                n = write (fd, data, len);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return FALSE;
+                data += n;
+                len -= n;
+        }
+
+        return TRUE;
+}
+
+/* Moves what has been received so far into a memfd; later chunks are
+ * spliced straight from the pipe into it. */
+static void
+receive_spill_to_memfd (ClipReceive *recv)
+{
+        gint fd;
+
+        fd = memfd_create ("msd-clipboard", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+                g_debug ("Clipboard manager: memfd_create failed: %s", g_strerror (errno));
+                return;
+        }
+
+        if (!write_all (fd, recv->data->data, recv->data->len)) {
+                g_debug ("Clipboard manager: could not fill memfd: %s", g_strerror (errno));
+                close (fd);
+                return;
+        }
+
+        recv->memfd = fd;
+        recv->memfd_size = recv->data->len;
+        g_byte_array_free (recv->data, TRUE);
+        recv->data = NULL;
+}
+
+static gssize
+receive_into_memfd (ClipReceive *recv)
+{
+        guint8 buf[RECEIVE_CHUNK_SIZE];
+        gssize n;
+
+        n = splice (recv->fd, NULL, recv->memfd, NULL, RECEIVE_CHUNK_SIZE,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n >= 0 || errno != EINVAL)
+                return n;
+
+        /* splice() is not supported for this pair of files */
+        n = read (recv->fd, buf, sizeof (buf));
+        if (n > 0 && !write_all (recv->memfd, buf, n)) {
+                errno = EIO;
+                return -1;
+        }
+
+        return n;
+}
+#endif /* HAVE_MEMFD_CREATE */
+
+static gssize
+receive_chunk (ClipReceive *recv)
+{
+        gsize  len;
+        gssize n;
+
+#ifdef HAVE_MEMFD_CREATE
+        if (recv->memfd != -1) {
+                n = receive_into_memfd (recv);
+                if (n > 0)
+                        recv->memfd_size += n;
+                return n;
+        }
+#endif
+
+        /* Read straight into the array's tail; GByteArray grows
+         * geometrically, so large payloads are not reallocated per chunk. */
+        len = recv->data->len;
+        g_byte_array_set_size (recv->data, len + RECEIVE_CHUNK_SIZE);
+        n = read (recv->fd, recv->data->data + len, RECEIVE_CHUNK_SIZE);
+        g_byte_array_set_size (recv->data, len + MAX (n, 0));
+
+#ifdef HAVE_MEMFD_CREATE
+        if (n > 0 && recv->wl->memfd_threshold > 0 &&
+            recv->data->len > recv->wl->memfd_threshold)
+                receive_spill_to_memfd (recv);
+#endif
+
+        return n;
+}
+
 static gboolean
 receive_dispatch_cb (gint         fd,
                      GIOCondition condition,
                      gpointer     user_data)
 {
         ClipReceive *recv = user_data;
-        guchar       buf[4096];
         gssize       n;
 
-        n = read (fd, buf, sizeof (buf));
+        n = receive_chunk (recv);
         if (n > 0) {
-                g_byte_array_append (recv->data, buf, n);
-                return G_SOURCE_CONTINUE;
+                SelectionState *state;
+
+                state = state_from_kind (recv->wl, recv->kind);
+                if (!state->receiving_deferred ||
+                    state->cache_size + receive_get_size (recv) <= CACHE_BUDGET_BYTES)
+                        return G_SOURCE_CONTINUE;
+
+                g_debug ("Clipboard manager: dropping '%s', it does not fit in the cache budget",
+                         recv->mime);
+                recv->dropped = TRUE;
+                receive_finish (recv);
+                return G_SOURCE_REMOVE;
         }
         if (n == 0) {
                 receive_finish (recv);
@@ -296,19 +801,138 @@ receive_dispatch_cb (gint         fd,
 }
 
 static void
-start_receives (SelectionState                          *state,
-                struct ext_data_control_offer_v1       *offer,
-                GPtrArray                              *mimes)
+receives_cancel_all (SelectionState *state)
 {
         guint i;
 
-        if (state->receives != NULL) {
-                for (i = 0; i < state->receives->len; i++)
-                        receive_cancel (state->receives->pdata[i]);
+        if (state->receives == NULL)
+                return;
+
+        for (i = 0; i < state->receives->len; i++)
+                receive_cancel (state->receives->pdata[i]);
+        g_ptr_array_free (state->receives, FALSE);
+        state->receives = NULL;
+        state->receiving_deferred = FALSE;
+}
+
+static gboolean
+receive_start (SelectionState                   *state,
+               struct ext_data_control_offer_v1 *offer,
+               const gchar                      *mime)
+{
+        ClipReceive *recv;
+        int          fds[2];
+
+        /* close-on-exec, so that no launched child keeps the write end
+         * open and hides the end of the transfer */
+        if (!g_unix_open_pipe (fds, FD_CLOEXEC, NULL))
+                return FALSE;
+
+        ext_data_control_offer_v1_receive (offer, mime, fds[1]);
+        close (fds[1]);
+
+        recv = g_new0 (ClipReceive, 1);
+        recv->wl = state->wl;
+        recv->kind = state->kind;
+        recv->fd = fds[0];
+        recv->mime = g_strdup (mime);
+        recv->data = g_byte_array_new ();
+        recv->memfd = -1;
+        fcntl (recv->fd, F_SETFL, O_NONBLOCK);
+        recv->source_id = g_unix_fd_add (recv->fd,
+                                         G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                         receive_dispatch_cb,
+                                         recv);
+        g_ptr_array_add (state->receives, recv);
+
+        return TRUE;
+}
+
+static void
+clear_deferred (SelectionState *state)
+{
+        if (state->deferred_timeout != 0) {
+                g_source_remove (state->deferred_timeout);
+                state->deferred_timeout = 0;
+        }
+
+        if (state->deferred_mimes != NULL) {
+                g_ptr_array_free (state->deferred_mimes, TRUE);
+                state->deferred_mimes = NULL;
+        }
+}
+
+static void
+fetch_next_deferred (SelectionState *state)
+{
+        /* Only fetch from a live offer that is not our own re-offer. */
+        if (state->offer == NULL || state->source != NULL || state->receives != NULL) {
+                clear_deferred (state);
+                return;
+        }
+
+        while (state->deferred_mimes != NULL && state->deferred_mimes->len > 0) {
+                gchar *mime;
+
+                if (state->cache_size >= CACHE_BUDGET_BYTES) {
+                        g_debug ("Clipboard manager: cache budget reached, not fetching %u more types",
+                                 state->deferred_mimes->len);
+                        break;
+                }
+
+                mime = g_ptr_array_steal_index (state->deferred_mimes, 0);
+
+                state->receives = g_ptr_array_new ();
+                state->receiving_deferred = TRUE;
+                if (receive_start (state, state->offer, mime)) {
+                        g_free (mime);
+                        return;
+                }
+
+                g_free (mime);
                 g_ptr_array_free (state->receives, FALSE);
                 state->receives = NULL;
+                state->receiving_deferred = FALSE;
         }
 
+        clear_deferred (state);
+}
+
+static gboolean
+deferred_fetch_cb (gpointer data)
+{
+        SelectionState *state = data;
+
+        state->deferred_timeout = 0;
+        fetch_next_deferred (state);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_deferred_fetch (SelectionState *state,
+                         guint           delay_ms)
+{
+        if (state->deferred_mimes == NULL || state->deferred_mimes->len == 0) {
+                clear_deferred (state);
+                return;
+        }
+
+        if (state->deferred_timeout == 0)
+                state->deferred_timeout = g_timeout_add (delay_ms, deferred_fetch_cb, state);
+}
+
+static void
+start_receives (SelectionState                          *state,
+                struct ext_data_control_offer_v1       *offer,
+                GPtrArray                              *mimes)
+{
+        GPtrArray *eager;
+        guint      i;
+
+        receives_cancel_all (state);
+        clear_deferred (state);
+
         state->receives = g_ptr_array_new ();
 
         if (mimes == NULL)
@@ -316,66 +940,163 @@ start_receives (SelectionState                          *state,
 
         state->last_activity_ms = g_get_monotonic_time () / 1000;
 
-        for (i = 0; i < mimes->len; i++) {
-                ClipReceive *recv;
-                int          fds[2];
+        eager = g_ptr_array_new_with_free_func (g_free);
+        state->deferred_mimes = g_ptr_array_new_with_free_func (g_free);
+        partition_mimes (mimes, eager, state->deferred_mimes);
 
-                if (pipe (fds) < 0)
-                        continue;
+        for (i = 0; i < eager->len; i++)
+                receive_start (state, offer, eager->pdata[i]);
 
-                ext_data_control_offer_v1_receive (offer, mimes->pdata[i], fds[1]);
-                close (fds[1]);
+        g_ptr_array_free (eager, TRUE);
+}
+
+/* Bytes written per wakeup, so one large paste cannot starve the other
+ * sends and the rest of the main loop. */
+#define SEND_CHUNK_SIZE        (64 * 1024)
+/* Give up on a consumer that has not read anything for this long. */
+#define SEND_STALL_TIMEOUT_MS  10000
+
+static gboolean send_stall_cb (gpointer user_data);
+
+static void
+send_free (gpointer data)
+{
+        ClipSend *send = data;
+
+        if (send->source_id != 0)
+                g_source_remove (send->source_id);
+        if (send->stall_timeout != 0)
+                g_source_remove (send->stall_timeout);
+        if (send->fd != -1)
+                close (send->fd);
+        clip_payload_unref (send->payload);
+        g_free (send);
+}
 
-                recv = g_new0 (ClipReceive, 1);
-                recv->wl = state->wl;
-                recv->kind = state->kind;
-                recv->fd = fds[0];
-                recv->mime = g_strdup (mimes->pdata[i]);
-                recv->data = g_byte_array_new ();
-                fcntl (recv->fd, F_SETFL, O_NONBLOCK);
-                recv->source_id = g_unix_fd_add (recv->fd,
-                                                 G_IO_IN | G_IO_HUP | G_IO_ERR,
-                                                 receive_dispatch_cb,
-                                                 recv);
-                g_ptr_array_add (state->receives, recv);
+static gssize
+send_chunk (ClipSend *send)
+{
+        ClipPayload *payload = send->payload;
+        gsize        count;
+
+        count = MIN (payload->size - send->offset, SEND_CHUNK_SIZE);
+
+#ifdef HAVE_MEMFD_CREATE
+        if (payload->fd != -1) {
+                guint8 buf[SEND_CHUNK_SIZE];
+                off_t  offset = send->offset;
+                gssize n;
+
+                n = sendfile (send->fd, payload->fd, &offset, count);
+                if (n >= 0 || (errno != EINVAL && errno != ENOSYS))
+                        return n;
+
+                n = pread (payload->fd, buf, count, send->offset);
+                if (n <= 0)
+                        return -1;
+
+                return write (send->fd, buf, n);
         }
+#endif
+
+        return write (send->fd,
+                      (const guint8 *) g_bytes_get_data (payload->bytes, NULL) + send->offset,
+                      count);
 }
 
 static void
-source_write_all (gint                fd,
-                  const guint8       *data,
-                  gsize               len)
+send_finish (ClipSend *send)
 {
-        gsize          total = 0;
-        gint           flags;
+        g_ptr_array_remove_fast (send->wl->sends, send);
+}
 
-        flags = fcntl (fd, F_GETFL, 0);
-        if (flags != -1)
-                fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+static gboolean
+send_dispatch_cb (gint         fd,
+                  GIOCondition condition,
+                  gpointer     user_data)
+{
+        ClipSend     *send = user_data;
+        gssize        n;
 
-        while (total < len) {
-                gssize n;
+        if (condition & (G_IO_HUP | G_IO_ERR)) {
+                send->source_id = 0;
+                send_finish (send);
+                return G_SOURCE_REMOVE;
+        }
 
-                n = write (fd, data + total, len - total);
-                if (n > 0) {
-                        total += n;
-                        continue;
-                }
-                if (n < 0 && errno == EINTR)
-                        continue;
-                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                        GPollFD pfd;
+        n = send_chunk (send);
+        if (n > 0) {
+                send->offset += n;
+                send->last_progress_ms = g_get_monotonic_time () / 1000;
+                if (send->offset < send->payload->size)
+                        return G_SOURCE_CONTINUE;
+        } else if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return G_SOURCE_CONTINUE;
+        }
 
-                        pfd.fd = fd;
-                        pfd.events = G_IO_OUT;
-                        if (g_poll (&pfd, 1, 10000) <= 0)
-                                break;
-                        continue;
-                }
-                break;
+        send->source_id = 0;
+        send_finish (send);
+        return G_SOURCE_REMOVE;
+}
+
+static void
+send_arm_stall_timeout (ClipSend *send,
+                        guint     delay_ms)
+{
+        send->stall_timeout = g_timeout_add (delay_ms, send_stall_cb, send);
+}
+
+static gboolean
+send_stall_cb (gpointer user_data)
+{
+        ClipSend *send = user_data;
+        gint64    idle_ms;
+
+        send->stall_timeout = 0;
+
+        idle_ms = g_get_monotonic_time () / 1000 - send->last_progress_ms;
+        if (idle_ms < SEND_STALL_TIMEOUT_MS) {
+                send_arm_stall_timeout (send, SEND_STALL_TIMEOUT_MS - idle_ms);
+                return G_SOURCE_REMOVE;
         }
 
-        close (fd);
+        g_debug ("Clipboard manager: giving up on a paste stalled at %" G_GSIZE_FORMAT
+                 " of %" G_GSIZE_FORMAT " bytes",
+                 send->offset, send->payload->size);
+        send_finish (send);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+send_start (MsdClipboardManagerWayland *wl,
+            gint                        fd,
+            ClipPayload                *payload)
+{
+        ClipSend *send;
+        gint      flags;
+
+        if (payload->size == 0) {
+                close (fd);
+                return;
+        }
+
+        flags = fcntl (fd, F_GETFL, 0);
+        if (flags != -1)
+                fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+
+        send = g_new0 (ClipSend, 1);
+        send->wl = wl;
+        send->fd = fd;
+        send->payload = clip_payload_ref (payload);
+        send->last_progress_ms = g_get_monotonic_time () / 1000;
+        send->source_id = g_unix_fd_add (fd,
+                                         G_IO_OUT | G_IO_HUP | G_IO_ERR,
+                                         send_dispatch_cb,
+                                         send);
+        send_arm_stall_timeout (send, SEND_STALL_TIMEOUT_MS);
+
+        g_ptr_array_add (wl->sends, send);
 }
 
 static void
@@ -397,7 +1118,7 @@ handle_source_send (void                                 *data,
 
                 entry = state->cache->pdata[i];
                 if (g_strcmp0 (entry->mime, mime_type) == 0) {
-                        source_write_all (fd, entry->data->data, entry->data->len);
+                        send_start (state->wl, fd, entry->payload);
                         return;
                 }
         }
@@ -509,6 +1230,12 @@ handle_selection_for (MsdClipboardManagerWayland      *wl,
         if (offer == NULL) {
                 state->offer = NULL;
 
+                /* The source is gone, so types not fetched yet are lost;
+                 * re-offer what the cache already holds. */
+                clear_deferred (state);
+                if (state->receiving_deferred)
+                        receives_cancel_all (state);
+
                 if (state->receives != NULL && state->receives->len > 0) {
                         state->reoffer_pending = TRUE;
                 } else {
@@ -649,9 +1376,8 @@ display_dispatch_cb (gint         fd,
 static void
 selection_state_clear (SelectionState *state)
 {
-        guint i;
-
         cancel_reoffer (state);
+        clear_deferred (state);
 
         if (state->source != NULL) {
                 ext_data_control_source_v1_destroy (state->source);
@@ -663,12 +1389,7 @@ selection_state_clear (SelectionState *state)
                 state->offer = NULL;
         }
 
-        if (state->receives != NULL) {
-                for (i = 0; i < state->receives->len; i++)
-                        receive_cancel (state->receives->pdata[i]);
-                g_ptr_array_free (state->receives, FALSE);
-                state->receives = NULL;
-        }
+        receives_cancel_all (state);
 
         if (state->cache != NULL) {
                 g_ptr_array_free (state->cache, TRUE);
@@ -676,6 +1397,17 @@ selection_state_clear (SelectionState *state)
         }
 }
 
+static void
+memfd_threshold_changed_cb (GSettings                  *settings,
+                            const gchar                *key,
+                            MsdClipboardManagerWayland *wl)
+{
+        gint kib;
+
+        kib = g_settings_get_int (settings, key);
+        wl->memfd_threshold = (gsize) MAX (kib, 0) * 1024;
+}
+
 MsdClipboardManagerWayland *
 msd_clipboard_manager_wayland_new (GError **error)
 {
@@ -695,6 +1427,12 @@ msd_clipboard_manager_wayland_new (GError **error)
         wl->clipboard.kind = MSD_WAYLAND_SELECTION_CLIPBOARD;
         wl->primary.wl = wl;
         wl->primary.kind = MSD_WAYLAND_SELECTION_PRIMARY;
+        wl->sends = g_ptr_array_new_with_free_func (send_free);
+
+        wl->settings = g_settings_new (CLIPBOARD_SCHEMA);
+        g_signal_connect (wl->settings, "changed::" KEY_MEMFD_THRESHOLD,
+                          G_CALLBACK (memfd_threshold_changed_cb), wl);
+        memfd_threshold_changed_cb (wl->settings, KEY_MEMFD_THRESHOLD, wl);
 
         wl->registry = wl_display_get_registry (wl->display);
         wl_registry_add_listener (wl->registry, &registry_listener, wl);
@@ -735,6 +1473,11 @@ msd_clipboard_manager_wayland_destroy (MsdClipboardManagerWayland *wl)
         selection_state_clear (&wl->clipboard);
         selection_state_clear (&wl->primary);
 
+        if (wl->sends != NULL) {
+                g_ptr_array_free (wl->sends, TRUE);
+                wl->sends = NULL;
+        }
+
         if (wl->pending_offer != NULL) {
                 ext_data_control_offer_v1_destroy (wl->pending_offer);
                 wl->pending_offer = NULL;
@@ -765,5 +1508,7 @@ msd_clipboard_manager_wayland_destroy (MsdClipboardManagerWayland *wl)
                 wl->display = NULL;
         }
 
+        g_clear_object (&wl->settings);
+
         g_free (wl);
 }
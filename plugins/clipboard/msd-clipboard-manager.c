@@ -62,8 +62,10 @@ struct MsdClipboardManagerPrivate
         Window   window;
         Time     timestamp;
 
-        List    *contents;
-        List    *conversions;
+        List       *contents;
+        GHashTable *contents_by_target;
+        int         n_incr_contents;
+        GHashTable *conversions;
 
         Window   requestor;
         Atom     property;
@@ -82,6 +84,11 @@ typedef struct
         Atom           type;
         int            format;
         int            refcount;
+
+        /* INCR receive state */
+        int            capacity;
+        gint64         start_time;
+        unsigned int   round_trips;
 } TargetData;
 
 typedef struct
@@ -91,6 +98,10 @@ typedef struct
         Atom        property;
         Window      requestor;
         int         offset;
+
+        /* INCR send state */
+        gint64       start_time;
+        unsigned int round_trips;
 } IncrConversion;
 
 static void     msd_clipboard_manager_finalize    (GObject *object);
@@ -135,6 +146,69 @@ conversion_free (IncrConversion *rdata)
         free (rdata);
 }
 
+/* Incremental conversions are looked up by (requestor, property) on
+ * every PropertyNotify, so they are kept in a set hashed on that pair.
+ */
+static guint
+conversion_hash (gconstpointer key)
+{
+        const IncrConversion *rdata = key;
+
+        return (guint) (rdata->requestor * 2654435761u) ^ (guint) rdata->property;
+}
+
+static gboolean
+conversion_equal (gconstpointer a,
+                  gconstpointer b)
+{
+        const IncrConversion *rdata_a = a;
+        const IncrConversion *rdata_b = b;
+
+        return (rdata_a->requestor == rdata_b->requestor &&
+                rdata_a->property == rdata_b->property);
+}
+
+/* The stored CLIPBOARD contents keep their list order for TARGETS
+ * replies, with an index by target atom for conversions and INCR steps.
+ */
+static void
+contents_add (MsdClipboardManager *manager,
+              TargetData          *tdata)
+{
+        manager->priv->contents = list_prepend (manager->priv->contents, tdata);
+        g_hash_table_insert (manager->priv->contents_by_target,
+                             GSIZE_TO_POINTER (tdata->target), tdata);
+}
+
+static void
+contents_remove (MsdClipboardManager *manager,
+                 TargetData          *tdata)
+{
+        manager->priv->contents = list_remove (manager->priv->contents, tdata);
+        if (g_hash_table_lookup (manager->priv->contents_by_target,
+                                 GSIZE_TO_POINTER (tdata->target)) == tdata)
+                g_hash_table_remove (manager->priv->contents_by_target,
+                                     GSIZE_TO_POINTER (tdata->target));
+}
+
+static TargetData *
+contents_lookup (MsdClipboardManager *manager,
+                 Atom                 target)
+{
+        return g_hash_table_lookup (manager->priv->contents_by_target,
+                                    GSIZE_TO_POINTER (target));
+}
+
+static void
+contents_clear (MsdClipboardManager *manager)
+{
+        list_foreach (manager->priv->contents, (Callback) target_data_unref, NULL);
+        list_free (manager->priv->contents);
+        manager->priv->contents = NULL;
+        g_hash_table_remove_all (manager->priv->contents_by_target);
+        manager->priv->n_incr_contents = 0;
+}
+
 static void
 send_selection_notify (MsdClipboardManager *manager,
                        Bool                 success)
@@ -207,6 +281,22 @@ clipboard_bytes_per_item (int format)
         return 0;
 }
 
+static void
+log_transfer (const char   *direction,
+              Atom          target,
+              int           length,
+              gint64        start_time,
+              unsigned int  round_trips)
+{
+        gint64 elapsed;
+
+        elapsed = MAX (g_get_monotonic_time () - start_time, 1);
+        g_debug ("Clipboard manager: %s %d bytes of target %lu incrementally "
+                 "in %u round trips, %.1f KiB/s",
+                 direction, length, (unsigned long) target, round_trips,
+                 length / 1024.0 * G_USEC_PER_SEC / elapsed);
+}
+
 static void
 save_targets (MsdClipboardManager *manager,
               Atom                *save_targets,
@@ -233,7 +323,10 @@ save_targets (MsdClipboardManager *manager,
                         tdata->type = None;
                         tdata->format = 0;
                         tdata->refcount = 1;
-                        manager->priv->contents = list_prepend (manager->priv->contents, tdata);
+                        tdata->capacity = 0;
+                        tdata->start_time = 0;
+                        tdata->round_trips = 0;
+                        contents_add (manager, tdata);
 
                         multiple[nout++] = save_targets[i];
                         multiple[nout++] = save_targets[i];
@@ -252,28 +345,6 @@ save_targets (MsdClipboardManager *manager,
                            manager->priv->window, manager->priv->time);
 }
 
-static int
-find_content_target (TargetData *tdata,
-                     Atom        target)
-{
-        return tdata->target == target;
-}
-
-static int
-find_content_type (TargetData *tdata,
-                   Atom        type)
-{
-        return tdata->type == type;
-}
-
-static int
-find_conversion_requestor (IncrConversion *rdata,
-                           XEvent         *xev)
-{
-        return (rdata->requestor == xev->xproperty.window &&
-                rdata->property == xev->xproperty.atom);
-}
-
 static void
 get_property (TargetData          *tdata,
               MsdClipboardManager *manager)
@@ -298,11 +369,28 @@ get_property (TargetData          *tdata,
                             &data);
 
         if (type == None) {
-                manager->priv->contents = list_remove (manager->priv->contents, tdata);
+                contents_remove (manager, tdata);
                 free (tdata);
         } else if (type == XA_INCR) {
                 tdata->type = type;
                 tdata->length = 0;
+                tdata->start_time = g_get_monotonic_time ();
+                tdata->round_trips = 0;
+
+                /* The INCR value is a lower bound on the size of the
+                 * selection, but it comes from the selection owner and
+                 * can be anything; preallocate for a few chunks at most
+                 * and let receive_incrementally() grow from there. */
+                tdata->capacity = 0;
+                if (format == 32 && length > 0 && *(long *) data > 0) {
+                        tdata->capacity = (int) MIN ((unsigned long) *(long *) data,
+                                                     INCR_CHUNK_SIZE * 4) + 1;
+                        tdata->data = malloc (tdata->capacity);
+                        if (tdata->data == NULL)
+                                tdata->capacity = 0;
+                }
+
+                manager->priv->n_incr_contents++;
                 XFree (data);
         } else {
                 tdata->type = type;
@@ -316,7 +404,6 @@ static Bool
 receive_incrementally (MsdClipboardManager *manager,
                        XEvent              *xev)
 {
-        List          *list;
         TargetData    *tdata;
         Atom           type;
         int            format;
@@ -326,14 +413,11 @@ receive_incrementally (MsdClipboardManager *manager,
         if (xev->xproperty.window != manager->priv->window)
                 return False;
 
-        list = list_find (manager->priv->contents,
-                          (ListFindFunc) find_content_target, (void *) xev->xproperty.atom);
+        tdata = contents_lookup (manager, xev->xproperty.atom);
 
-        if (!list)
+        if (!tdata)
                 return False;
 
-        tdata = (TargetData *) list->data;
-
         if (tdata->type != XA_INCR)
                 return False;
 
@@ -344,12 +428,17 @@ receive_incrementally (MsdClipboardManager *manager,
                             &type, &format, &nitems, &remaining, &data);
 
         length = nitems * clipboard_bytes_per_item (format);
+        tdata->round_trips++;
         if (length == 0) {
                 tdata->type = type;
                 tdata->format = format;
+                if (type != XA_INCR)
+                        manager->priv->n_incr_contents--;
+
+                log_transfer ("received", tdata->target, tdata->length,
+                              tdata->start_time, tdata->round_trips);
 
-                if (!list_find (manager->priv->contents,
-                                (ListFindFunc) find_content_type, (void *)XA_INCR)) {
+                if (manager->priv->n_incr_contents == 0) {
                         /* all incremental transfers done */
                         send_selection_notify (manager, True);
                         manager->priv->requestor = None;
@@ -360,8 +449,15 @@ receive_incrementally (MsdClipboardManager *manager,
                 if (!tdata->data) {
                         tdata->data = data;
                         tdata->length = length;
+                        tdata->capacity = length + 1;
                 } else {
-                        tdata->data = realloc (tdata->data, tdata->length + length + 1);
+                        /* Grow geometrically so that selections larger
+                         * than their size hint are not copied per chunk. */
+                        if (tdata->length + length + 1 > tdata->capacity) {
+                                tdata->capacity = MAX (tdata->length + length + 1,
+                                                       tdata->capacity * 2);
+                                tdata->data = realloc (tdata->data, tdata->capacity);
+                        }
                         memcpy (tdata->data + tdata->length, data, length + 1);
                         tdata->length += length;
                         XFree (data);
@@ -375,25 +471,25 @@ static Bool
 send_incrementally (MsdClipboardManager *manager,
                     XEvent              *xev)
 {
-        List           *list;
         IncrConversion *rdata;
+        IncrConversion  key;
         unsigned long   length;
         unsigned long   items;
         unsigned char  *data;
 
-        list = list_find (manager->priv->conversions,
-                          (ListFindFunc) find_conversion_requestor, xev);
-        if (list == NULL)
+        key.requestor = xev->xproperty.window;
+        key.property = xev->xproperty.atom;
+        rdata = g_hash_table_lookup (manager->priv->conversions, &key);
+        if (rdata == NULL)
                 return False;
 
-        rdata = (IncrConversion *) list->data;
-
         data = rdata->data->data + rdata->offset;
         length = rdata->data->length - rdata->offset;
-        if (length > SELECTION_MAX_SIZE)
-                length = SELECTION_MAX_SIZE;
+        if (length > INCR_CHUNK_SIZE)
+                length = INCR_CHUNK_SIZE;
 
         rdata->offset += length;
+        rdata->round_trips++;
 
         items = length / clipboard_bytes_per_item (rdata->data->format);
         XChangeProperty (manager->priv->display, rdata->requestor,
@@ -402,8 +498,9 @@ send_incrementally (MsdClipboardManager *manager,
                          data, items);
 
         if (length == 0) {
-                manager->priv->conversions = list_remove (manager->priv->conversions, rdata);
-                conversion_free (rdata);
+                log_transfer ("sent", rdata->target, rdata->data->length,
+                              rdata->start_time, rdata->round_trips);
+                g_hash_table_remove (manager->priv->conversions, rdata);
         }
 
         return True;
@@ -536,14 +633,12 @@ convert_clipboard_target (IncrConversion      *rdata,
                 free (targets);
         } else  {
                 /* Convert from stored CLIPBOARD data */
-                list = list_find (manager->priv->contents,
-                                  (ListFindFunc) find_content_target, (void *) rdata->target);
+                tdata = contents_lookup (manager, rdata->target);
 
                 /* We got a target that we don't support */
-                if (!list)
+                if (!tdata)
                         return;
 
-                tdata = (TargetData *)list->data;
                 if (tdata->type == XA_INCR) {
                         /* we haven't completely received this target yet  */
                         rdata->property = None;
@@ -560,6 +655,8 @@ convert_clipboard_target (IncrConversion      *rdata,
                 else {
                         /* start incremental transfer */
                         rdata->offset = 0;
+                        rdata->start_time = g_get_monotonic_time ();
+                        rdata->round_trips = 0;
 
                         gdk_x11_display_error_trap_push (display);
 
@@ -584,7 +681,7 @@ collect_incremental (IncrConversion      *rdata,
                      MsdClipboardManager *manager)
 {
         if (rdata->offset >= 0)
-                manager->priv->conversions = list_prepend (manager->priv->conversions, rdata);
+                g_hash_table_add (manager->priv->conversions, rdata);
         else {
                 if (rdata->data) {
                         target_data_unref (rdata->data);
@@ -690,9 +787,7 @@ clipboard_manager_process_event (MsdClipboardManager *manager,
         switch (xev->xany.type) {
         case DestroyNotify:
                 if (xev->xdestroywindow.window == manager->priv->requestor) {
-                        list_foreach (manager->priv->contents, (Callback)target_data_unref, NULL);
-                        list_free (manager->priv->contents);
-                        manager->priv->contents = NULL;
+                        contents_clear (manager);
 
                         clipboard_manager_watch_cb (manager,
                                                     manager->priv->requestor,
@@ -716,9 +811,7 @@ clipboard_manager_process_event (MsdClipboardManager *manager,
                 if (xev->xselectionclear.selection == XA_CLIPBOARD_MANAGER) {
                         /* We lost the manager selection */
                         if (manager->priv->contents) {
-                                list_foreach (manager->priv->contents, (Callback)target_data_unref, NULL);
-                                list_free (manager->priv->contents);
-                                manager->priv->contents = NULL;
+                                contents_clear (manager);
 
                                 XSetSelectionOwner (manager->priv->display,
                                                     XA_CLIPBOARD,
@@ -729,9 +822,7 @@ clipboard_manager_process_event (MsdClipboardManager *manager,
                 }
                 if (xev->xselectionclear.selection == XA_CLIPBOARD) {
                         /* We lost the clipboard selection */
-                        list_foreach (manager->priv->contents, (Callback)target_data_unref, NULL);
-                        list_free (manager->priv->contents);
-                        manager->priv->contents = NULL;
+                        contents_clear (manager);
                         clipboard_manager_watch_cb (manager,
                                                     manager->priv->requestor,
                                                     False,
@@ -776,8 +867,7 @@ clipboard_manager_process_event (MsdClipboardManager *manager,
                                                          XA_ATOM, 32, PropModeReplace,
                                                          (unsigned char *)&XA_NULL, 1);
 
-                                if (!list_find (manager->priv->contents,
-                                                (ListFindFunc)find_content_type, (void *)XA_INCR)) {
+                                if (manager->priv->n_incr_contents == 0) {
                                         /* all transfers done */
                                         send_selection_notify (manager, True);
                                         clipboard_manager_watch_cb (manager,
@@ -884,7 +974,12 @@ start_clipboard_idle_cb (MsdClipboardManager *manager)
         }
 
         manager->priv->contents = NULL;
-        manager->priv->conversions = NULL;
+        manager->priv->contents_by_target = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->n_incr_contents = 0;
+        manager->priv->conversions = g_hash_table_new_full (conversion_hash,
+                                                            conversion_equal,
+                                                            (GDestroyNotify) conversion_free,
+                                                            NULL);
         manager->priv->requestor = None;
 
         manager->priv->window = XCreateSimpleWindow (manager->priv->display,
@@ -993,11 +1088,12 @@ msd_clipboard_manager_stop (MsdClipboardManager *manager)
                                             NULL);
                 XDestroyWindow (manager->priv->display, manager->priv->window);
 
-                list_foreach (manager->priv->conversions, (Callback) conversion_free, NULL);
-                list_free (manager->priv->conversions);
+                g_clear_pointer (&manager->priv->conversions, g_hash_table_destroy);
 
-                list_foreach (manager->priv->contents, (Callback) target_data_unref, NULL);
-                list_free (manager->priv->contents);
+                if (manager->priv->contents_by_target != NULL) {
+                        contents_clear (manager);
+                        g_clear_pointer (&manager->priv->contents_by_target, g_hash_table_destroy);
+                }
 
                 return;
         }
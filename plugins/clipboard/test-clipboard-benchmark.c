@@ -0,0 +1,188 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+/* Measures the cost of dispatching X events through the clipboard
+ * manager's target and conversion lookups.  The manager sources are
+ * included directly so the static event handler can be driven without
+ * claiming CLIPBOARD_MANAGER; only events that are answered from the
+ * lookup tables alone are used, so no X round trips are timed.
+ *
+ * Usage: test-clipboard-benchmark [N_TARGETS] [N_CONVERSIONS] [N_EVENTS]
+ */
+
+#include "msd-clipboard-manager.c"
+
+static void
+add_synthetic_contents (MsdClipboardManager *manager,
+                        Atom                *targets,
+                        int                  n_targets)
+{
+        int i;
+
+        for (i = 0; i < n_targets; i++) {
+                TargetData *tdata;
+
+                tdata = (TargetData *) malloc (sizeof (TargetData));
+                tdata->data = NULL;
+                tdata->length = 0;
+                tdata->target = targets[i];
+                tdata->type = XA_STRING;
+                tdata->format = 8;
+                tdata->refcount = 1;
+                tdata->capacity = 0;
+                tdata->start_time = 0;
+                tdata->round_trips = 0;
+                contents_add (manager, tdata);
+        }
+}
+
+static void
+add_synthetic_conversions (MsdClipboardManager *manager,
+                           Atom                *properties,
+                           int                  n_conversions)
+{
+        int i;
+
+        for (i = 0; i < n_conversions; i++) {
+                IncrConversion *rdata;
+
+                rdata = (IncrConversion *) malloc (sizeof (IncrConversion));
+                rdata->requestor = (Window) (0x1000 + i);
+                rdata->target = XA_STRING;
+                rdata->property = properties[i];
+                rdata->data = NULL;
+                rdata->offset = 0;
+                rdata->start_time = g_get_monotonic_time ();
+                rdata->round_trips = 0;
+                collect_incremental (rdata, manager);
+        }
+}
+
+static double
+run_events (MsdClipboardManager *manager,
+            XEvent              *events,
+            int                  n_kinds,
+            int                  n_events)
+{
+        gint64 start;
+        int    i;
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_events; i++)
+                clipboard_manager_process_event (manager, &events[i % n_kinds]);
+
+        return (g_get_monotonic_time () - start) * 1000.0 / n_events;
+}
+
+int
+main (int argc, char *argv[])
+{
+        MsdClipboardManager *manager;
+        Display             *display;
+        Atom                *atoms;
+        char               **names;
+        XEvent              *events;
+        int                  n_targets = 64;
+        int                  n_conversions = 32;
+        int                  n_events = 1000000;
+        int                  i;
+
+        gtk_init (&argc, &argv);
+
+        if (argc > 1)
+                n_targets = MAX (atoi (argv[1]), 1);
+        if (argc > 2)
+                n_conversions = MAX (atoi (argv[2]), 1);
+        if (argc > 3)
+                n_events = MAX (atoi (argv[3]), 1);
+
+        if (!GDK_IS_X11_DISPLAY (gdk_display_get_default ())) {
+                g_printerr ("This benchmark needs an X11 display\n");
+                return 1;
+        }
+
+        manager = msd_clipboard_manager_new ();
+        display = manager->priv->display;
+        init_atoms (display);
+
+        manager->priv->window = XCreateSimpleWindow (display, DefaultRootWindow (display),
+                                                     0, 0, 10, 10, 0, 0, 0);
+        manager->priv->contents = NULL;
+        manager->priv->contents_by_target = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->n_incr_contents = 0;
+        manager->priv->conversions = g_hash_table_new_full (conversion_hash,
+                                                            conversion_equal,
+                                                            (GDestroyNotify) conversion_free,
+                                                            NULL);
+        manager->priv->requestor = None;
+
+        names = g_new0 (char *, n_targets + n_conversions);
+        for (i = 0; i < n_targets; i++)
+                names[i] = g_strdup_printf ("MSD_BENCH_TARGET_%d", i);
+        for (i = 0; i < n_conversions; i++)
+                names[n_targets + i] = g_strdup_printf ("MSD_BENCH_PROPERTY_%d", i);
+
+        atoms = g_new0 (Atom, n_targets + n_conversions);
+        XInternAtoms (display, names, n_targets + n_conversions, False, atoms);
+
+        add_synthetic_contents (manager, atoms, n_targets);
+        add_synthetic_conversions (manager, atoms + n_targets, n_conversions);
+
+        /* PropertyNewValue on our own window for a stored, non-INCR
+         * target: a target lookup that hits. */
+        events = g_new0 (XEvent, n_targets);
+        for (i = 0; i < n_targets; i++) {
+                events[i].xproperty.type = PropertyNotify;
+                events[i].xproperty.display = display;
+                events[i].xproperty.window = manager->priv->window;
+                events[i].xproperty.atom = atoms[i];
+                events[i].xproperty.state = PropertyNewValue;
+        }
+        g_print ("target lookup:      %d targets, %.1f ns/event\n",
+                 n_targets, run_events (manager, events, n_targets, n_events));
+        g_free (events);
+
+        /* PropertyDelete from a requestor with no transfer in progress:
+         * a conversion lookup that misses. */
+        events = g_new0 (XEvent, n_conversions);
+        for (i = 0; i < n_conversions; i++) {
+                events[i].xproperty.type = PropertyNotify;
+                events[i].xproperty.display = display;
+                events[i].xproperty.window = (Window) (0x2000 + i);
+                events[i].xproperty.atom = atoms[n_targets + i];
+                events[i].xproperty.state = PropertyDelete;
+        }
+        g_print ("conversion lookup:  %d conversions, %.1f ns/event\n",
+                 n_conversions, run_events (manager, events, n_conversions, n_events));
+        g_free (events);
+
+        g_hash_table_destroy (manager->priv->conversions);
+        contents_clear (manager);
+        g_hash_table_destroy (manager->priv->contents_by_target);
+        XDestroyWindow (display, manager->priv->window);
+
+        for (i = 0; i < n_targets + n_conversions; i++)
+                g_free (names[i]);
+        g_free (names);
+        g_free (atoms);
+        g_object_unref (manager);
+
+        return 0;
+}
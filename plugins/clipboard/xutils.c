@@ -41,6 +41,11 @@ Atom XA_TARGETS;
 Atom XA_TIMESTAMP;
 
 unsigned long SELECTION_MAX_SIZE = 0;
+unsigned long INCR_CHUNK_SIZE = 0;
+
+/* Upper bound for a single INCR chunk: large enough that big images
+ * take few round trips, small enough not to stall the X server. */
+#define INCR_CHUNK_MAX_SIZE (4 * 1024 * 1024)
 
 void
 init_atoms (Display *display)
@@ -71,6 +76,16 @@ init_atoms (Display *display)
   SELECTION_MAX_SIZE = max_request_size - 100;
   if (SELECTION_MAX_SIZE > 262144)
     SELECTION_MAX_SIZE =  262144;
+
+  /* The maximum request size is in 4 byte units; keep some room for the
+   * ChangeProperty request header and round down to whole 64 bit items
+   * so format 32 data (stored as longs) is never split. */
+  INCR_CHUNK_SIZE = (max_request_size - 100) * 4;
+  if (INCR_CHUNK_SIZE > INCR_CHUNK_MAX_SIZE)
+    INCR_CHUNK_SIZE = INCR_CHUNK_MAX_SIZE;
+  if (INCR_CHUNK_SIZE < SELECTION_MAX_SIZE)
+    INCR_CHUNK_SIZE = SELECTION_MAX_SIZE;
+  INCR_CHUNK_SIZE &= ~7UL;
 }
 
 typedef struct
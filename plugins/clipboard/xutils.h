@@ -41,6 +41,7 @@ extern Atom XA_TARGETS;
 extern Atom XA_TIMESTAMP;
 
 extern unsigned long SELECTION_MAX_SIZE;
+extern unsigned long INCR_CHUNK_SIZE;
 
 void init_atoms      (Display *display);
 
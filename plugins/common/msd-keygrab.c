@@ -44,9 +44,26 @@ static GdkModifierType msd_ignored_mods = 0;
  * for these set */
 static GdkModifierType msd_used_mods = 0;
 
+static void
+modifiers_changed_cb (GdkKeymap *keymap,
+                      gpointer   user_data)
+{
+        /* NumLock may have moved to another modifier */
+        msd_ignored_mods = 0;
+        msd_used_mods = 0;
+}
+
 static void
 setup_modifiers (void)
 {
+        static gboolean watching_keymap = FALSE;
+
+        if (!watching_keymap) {
+                g_signal_connect (gdk_keymap_get_for_display (gdk_display_get_default ()),
+                                  "keys-changed", G_CALLBACK (modifiers_changed_cb), NULL);
+                watching_keymap = TRUE;
+        }
+
         if (msd_used_mods == 0 || msd_ignored_mods == 0) {
                 GdkModifierType dynmods;
 
@@ -120,10 +137,11 @@ grab_key_real (guint      keycode,
  * operations with one flush only.
  */
 #define N_BITS 32
-void
-grab_key_unsafe (Key                 *key,
-                 gboolean             grab,
-                 GSList              *screens)
+static void
+grab_keycodes_unsafe (guint               *keycodes,
+                      guint                state,
+                      gboolean             grab,
+                      GSList              *screens)
 {
         int   indexes[N_BITS]; /* indexes of bits we need to flip */
         int   i;
@@ -134,7 +152,7 @@ grab_key_unsafe (Key                 *key,
 
         setup_modifiers ();
 
-        mask = msd_ignored_mods & ~key->state & GDK_MODIFIER_MASK;
+        mask = msd_ignored_mods & ~state & GDK_MODIFIER_MASK;
 
         bit = 0;
         /* store the indexes of all set bits in mask in the array */
@@ -164,16 +182,24 @@ grab_key_unsafe (Key                 *key,
                         GdkScreen *screen = l->data;
                         guint *code;
 
-                        for (code = key->keycodes; *code; ++code) {
+                        for (code = keycodes; *code; ++code) {
                                 grab_key_real (*code,
                                                gdk_screen_get_root_window (screen),
                                                grab,
-                                               result | key->state);
+                                               result | state);
                         }
                 }
         }
 }
 
+void
+grab_key_unsafe (Key                 *key,
+                 gboolean             grab,
+                 GSList              *screens)
+{
+        grab_keycodes_unsafe (key->keycodes, key->state, grab, screens);
+}
+
 static gboolean
 have_xkb (Display *dpy)
 {
@@ -213,44 +239,80 @@ key_uses_keycode (const Key *key, guint keycode)
 }
 
 #ifdef GDK_WINDOWING_X11
-gboolean
-match_key (Key *key, XEvent *event)
+/* The result of translating a key event once, shared by all the keys it
+ * is matched against */
+typedef struct {
+        guint    keycode;
+        gboolean translated;
+        guint    lower;
+        guint    upper;
+        guint    state_lower;   /* used modifiers not consumed, Shift kept */
+        guint    state_upper;   /* used modifiers not consumed */
+        guint    state_raw;     /* used modifiers */
+} KeyTranslation;
+
+static void
+translate_event (XEvent         *event,
+                 KeyTranslation *t)
 {
-	guint keyval;
-	GdkModifierType consumed;
-	gint group;
+        guint keyval;
+        GdkModifierType consumed;
+        gint group;
 
-	if (key == NULL)
-		return FALSE;
+        setup_modifiers ();
 
-	setup_modifiers ();
+        if (have_xkb (event->xkey.display))
+                group = XkbGroupForCoreState (event->xkey.state);
+        else
+                group = (event->xkey.state & GDK_KEY_Mode_switch) ? 1 : 0;
+
+        t->keycode = event->xkey.keycode;
+        t->state_raw = event->xkey.state & msd_used_mods;
+
+        /* Check if we find a keysym that matches our current state */
+        t->translated = gdk_keymap_translate_keyboard_state (gdk_keymap_get_for_display (gdk_display_get_default ()),
+                                                             event->xkey.keycode,
+                                                             event->xkey.state, group,
+                                                             &keyval, NULL, NULL, &consumed);
+        if (t->translated) {
+                gdk_keyval_convert_case (keyval, &t->lower, &t->upper);
+
+                /* If we are checking against the lower version of the
+                 * keysym, we might need the Shift state for matching,
+                 * so remove it from the consumed modifiers */
+                t->state_lower = event->xkey.state & ~(consumed & ~GDK_SHIFT_MASK) & msd_used_mods;
+                t->state_upper = event->xkey.state & ~consumed & msd_used_mods;
+        }
+}
 
-	if (have_xkb (event->xkey.display))
-		group = XkbGroupForCoreState (event->xkey.state);
-	else
-		group = (event->xkey.state & GDK_KEY_Mode_switch) ? 1 : 0;
+static gboolean
+match_translation (const Key            *key,
+                   const KeyTranslation *t)
+{
+        if (t->translated) {
+                if (t->lower == key->keysym)
+                        return t->state_lower == key->state;
+                if (t->upper == key->keysym)
+                        return t->state_upper == key->state;
+                return FALSE;
+        }
 
-	/* Check if we find a keysym that matches our current state */
-	if (gdk_keymap_translate_keyboard_state (gdk_keymap_get_for_display (gdk_display_get_default ()), event->xkey.keycode,
-					     event->xkey.state, group,
-					     &keyval, NULL, NULL, &consumed)) {
-		guint lower, upper;
+        /* The key we passed doesn't have a keysym, so try with just the keycode */
+        return (key->state == t->state_raw
+                && key_uses_keycode (key, t->keycode));
+}
 
-		gdk_keyval_convert_case (keyval, &lower, &upper);
+gboolean
+match_key (Key *key, XEvent *event)
+{
+        KeyTranslation t;
 
-		/* If we are checking against the lower version of the
-		 * keysym, we might need the Shift state for matching,
-		 * so remove it from the consumed modifiers */
-		if (lower == key->keysym)
-			consumed &= ~GDK_SHIFT_MASK;
+        if (key == NULL)
+                return FALSE;
 
-		return ((lower == key->keysym || upper == key->keysym)
-			&& (event->xkey.state & ~consumed & msd_used_mods) == key->state);
-	}
+        translate_event (event, &t);
 
-	/* The key we passed doesn't have a keysym, so try with just the keycode */
-        return (key->state == (event->xkey.state & msd_used_mods)
-                && key_uses_keycode (key, event->xkey.keycode));
+        return match_translation (key, &t);
 }
 #else /* !GDK_WINDOWING_X11 */
 gboolean
@@ -259,3 +321,556 @@ match_key (Key *key, XEvent *event)
 	return FALSE;
 }
 #endif /* GDK_WINDOWING_X11 */
+
+/* Every plugin links its own copy of this file, and each MsdKeyTable
+ * is a plugin's view of one index shared by all of them.  The index is
+ * attached to the display, not kept in a static variable, so that the
+ * copies find the same one; they are built from the same sources, so
+ * they agree on its layout.  Sharing it means a key event is translated
+ * once, however many plugins look it up. */
+#define KEY_INDEX_DATA "msd-keygrab-key-index"
+
+typedef struct {
+        MsdKeyTable *table;
+        Key         *key;
+        gpointer     data;
+        guint        seq;
+} KeyTableEntry;
+
+typedef struct {
+        gint64     id;          /* keycode and modifier state */
+        GPtrArray *entries;     /* KeyTableEntry, not owned */
+} KeyTableBucket;
+
+typedef struct {
+        gint            ref_count;
+        GPtrArray      *entries;        /* KeyTableEntry in registration order */
+        GHashTable     *index;          /* &bucket->id -> KeyTableBucket */
+        gboolean        dirty;
+        guint           next_seq;
+        GdkDisplay     *display;
+        GdkKeymap      *keymap;
+        gulong          keys_changed_id;
+
+        /* the translation of the last event looked up */
+        gboolean        last_valid;
+#ifdef GDK_WINDOWING_X11
+        gulong          last_serial;
+        Time            last_time;
+        guint           last_keycode;
+        guint           last_state;
+        KeyTranslation  last;
+#endif /* GDK_WINDOWING_X11 */
+} KeyIndex;
+
+struct _MsdKeyTable {
+        KeyIndex *index;
+};
+
+static gint64
+bucket_id (guint keycode,
+           guint state)
+{
+        return ((gint64) state << 8) | (keycode & 0xff);
+}
+
+static void
+key_table_bucket_free (KeyTableBucket *bucket)
+{
+        g_ptr_array_free (bucket->entries, TRUE);
+        g_free (bucket);
+}
+
+static void
+keys_changed_cb (GdkKeymap *keymap,
+                 KeyIndex  *index)
+{
+        index->dirty = TRUE;
+        index->last_valid = FALSE;
+}
+
+static KeyIndex *
+key_index_ref (void)
+{
+        GdkDisplay *display = gdk_display_get_default ();
+        KeyIndex   *index;
+
+        index = g_object_get_data (G_OBJECT (display), KEY_INDEX_DATA);
+        if (index != NULL) {
+                index->ref_count++;
+                return index;
+        }
+
+        index = g_new0 (KeyIndex, 1);
+        index->ref_count = 1;
+        index->entries = g_ptr_array_new_with_free_func (g_free);
+        index->index = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                              NULL, (GDestroyNotify) key_table_bucket_free);
+        index->display = display;
+        index->keymap = gdk_keymap_get_for_display (display);
+        index->keys_changed_id = g_signal_connect (index->keymap, "keys-changed",
+                                                   G_CALLBACK (keys_changed_cb), index);
+
+        g_object_set_data (G_OBJECT (display), KEY_INDEX_DATA, index);
+
+        return index;
+}
+
+static void
+key_index_unref (KeyIndex *index)
+{
+        if (--index->ref_count > 0)
+                return;
+
+        g_object_set_data (G_OBJECT (index->display), KEY_INDEX_DATA, NULL);
+        g_signal_handler_disconnect (index->keymap, index->keys_changed_id);
+        g_hash_table_destroy (index->index);
+        g_ptr_array_free (index->entries, TRUE);
+        g_free (index);
+}
+
+/* A table of grabbed keys indexed by keycode and modifier state, so that
+ * a key event is translated once and only compared with the keys bound
+ * to its keycode.  Since grabs are made for every keycode that produces
+ * a key's keysym, a key can only match events carrying one of its
+ * keycodes.  Lookups only return keys added to the same table. */
+MsdKeyTable *
+msd_key_table_new (void)
+{
+        MsdKeyTable *table;
+
+        table = g_new0 (MsdKeyTable, 1);
+        table->index = key_index_ref ();
+
+        return table;
+}
+
+void
+msd_key_table_free (MsdKeyTable *table)
+{
+        if (table == NULL)
+                return;
+
+        msd_key_table_remove_all (table);
+        key_index_unref (table->index);
+        g_free (table);
+}
+
+/* Registers @key, which must stay valid until it is removed again.  When
+ * several keys of the table match an event, the one added first wins. */
+void
+msd_key_table_add (MsdKeyTable *table,
+                   Key         *key,
+                   gpointer     data)
+{
+        KeyTableEntry *entry;
+
+        g_return_if_fail (key != NULL);
+
+        entry = g_new (KeyTableEntry, 1);
+        entry->table = table;
+        entry->key = key;
+        entry->data = data;
+        entry->seq = table->index->next_seq++;
+        g_ptr_array_add (table->index->entries, entry);
+
+        table->index->dirty = TRUE;
+}
+
+void
+msd_key_table_remove_all (MsdKeyTable *table)
+{
+        GPtrArray *entries = table->index->entries;
+        guint      i, j;
+
+        /* compact in place, keeping the other tables' keys in order */
+        for (i = 0, j = 0; i < entries->len; i++) {
+                KeyTableEntry *entry = g_ptr_array_index (entries, i);
+
+                if (entry->table == table)
+                        g_free (entry);
+                else
+                        g_ptr_array_index (entries, j++) = entry;
+        }
+
+        if (j < entries->len) {
+                /* the removed entries were freed above */
+                g_ptr_array_set_free_func (entries, NULL);
+                g_ptr_array_set_size (entries, j);
+                g_ptr_array_set_free_func (entries, g_free);
+                table->index->dirty = TRUE;
+        }
+}
+
+static void
+key_index_rebuild (KeyIndex *index)
+{
+        guint i;
+
+        g_hash_table_remove_all (index->index);
+
+        for (i = 0; i < index->entries->len; i++) {
+                KeyTableEntry *entry = g_ptr_array_index (index->entries, i);
+                guint         *code;
+
+                if (entry->key->keycodes == NULL)
+                        continue;
+
+                for (code = entry->key->keycodes; *code; ++code) {
+                        KeyTableBucket *bucket;
+                        gint64          id = bucket_id (*code, entry->key->state);
+
+                        bucket = g_hash_table_lookup (index->index, &id);
+                        if (bucket == NULL) {
+                                bucket = g_new (KeyTableBucket, 1);
+                                bucket->id = id;
+                                bucket->entries = g_ptr_array_new ();
+                                g_hash_table_insert (index->index, &bucket->id, bucket);
+                        }
+
+                        /* a key may list the same keycode twice */
+                        if (bucket->entries->len == 0 ||
+                            g_ptr_array_index (bucket->entries, bucket->entries->len - 1) != entry)
+                                g_ptr_array_add (bucket->entries, entry);
+                }
+        }
+
+        index->dirty = FALSE;
+}
+
+#ifdef GDK_WINDOWING_X11
+static void
+lookup_bucket (MsdKeyTable           *table,
+               const KeyTranslation  *t,
+               guint                  state,
+               KeyTableEntry        **best)
+{
+        KeyTableBucket *bucket;
+        gint64          id = bucket_id (t->keycode, state);
+        guint           i;
+
+        bucket = g_hash_table_lookup (table->index->index, &id);
+        if (bucket == NULL)
+                return;
+
+        for (i = 0; i < bucket->entries->len; i++) {
+                KeyTableEntry *entry = g_ptr_array_index (bucket->entries, i);
+
+                if (entry->table != table)
+                        continue;
+
+                if (*best != NULL && (*best)->seq < entry->seq)
+                        break;
+
+                if (match_translation (entry->key, t)) {
+                        *best = entry;
+                        break;
+                }
+        }
+}
+
+/* The translation of @event, reused when another table looks up the
+ * same event */
+static const KeyTranslation *
+key_index_translate (KeyIndex *index,
+                     XEvent   *event)
+{
+        if (!index->last_valid ||
+            index->last_serial != event->xkey.serial ||
+            index->last_time != event->xkey.time ||
+            index->last_keycode != event->xkey.keycode ||
+            index->last_state != event->xkey.state) {
+                translate_event (event, &index->last);
+                index->last_serial = event->xkey.serial;
+                index->last_time = event->xkey.time;
+                index->last_keycode = event->xkey.keycode;
+                index->last_state = event->xkey.state;
+                index->last_valid = TRUE;
+        }
+
+        return &index->last;
+}
+
+/* Returns the data of the first key of @table matching @event, or
+ * %NULL */
+gpointer
+msd_key_table_lookup (MsdKeyTable *table,
+                      XEvent      *event)
+{
+        const KeyTranslation *t;
+        KeyTableEntry        *best = NULL;
+
+        if (table->index->entries->len == 0)
+                return NULL;
+
+        if (table->index->dirty)
+                key_index_rebuild (table->index);
+
+        t = key_index_translate (table->index, event);
+
+        if (t->translated) {
+                lookup_bucket (table, t, t->state_lower, &best);
+                if (t->state_upper != t->state_lower)
+                        lookup_bucket (table, t, t->state_upper, &best);
+        } else {
+                lookup_bucket (table, t, t->state_raw, &best);
+        }
+
+        return best != NULL ? best->data : NULL;
+}
+#else /* !GDK_WINDOWING_X11 */
+gpointer
+msd_key_table_lookup (MsdKeyTable *table,
+                      XEvent      *event)
+{
+        return NULL;
+}
+#endif /* GDK_WINDOWING_X11 */
+
+/* A grab of one keycode with one modifier state, on all screens of the
+ * set and with every combination of the ignored modifiers. */
+typedef struct {
+        gint64    id;
+        guint     keycodes[2];  /* zero-terminated for grab_keycodes_unsafe */
+        guint     state;
+        Key      *owner;        /* only valid during msd_grab_set_commit */
+        gpointer  data;
+        gulong    first_serial;
+        gulong    last_serial;
+        gboolean  denied;
+} GrabEntry;
+
+struct _MsdGrabSet {
+        GHashTable *grabbed;    /* &entry->id -> GrabEntry */
+        GHashTable *pending;    /* &entry->id -> GrabEntry */
+        GPtrArray  *conflicts;  /* GrabEntry of keys that lost to an earlier one */
+        GSList     *screens;
+};
+
+static GrabEntry *
+grab_entry_new (guint     keycode,
+                guint     state,
+                Key      *owner,
+                gpointer  data)
+{
+        GrabEntry *entry = g_new0 (GrabEntry, 1);
+
+        entry->id = bucket_id (keycode, state);
+        entry->keycodes[0] = keycode;
+        entry->state = state;
+        entry->owner = owner;
+        entry->data = data;
+
+        return entry;
+}
+
+MsdGrabSet *
+msd_grab_set_new (void)
+{
+        MsdGrabSet *set;
+
+        set = g_new0 (MsdGrabSet, 1);
+        set->grabbed = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, g_free);
+        set->pending = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, g_free);
+        set->conflicts = g_ptr_array_new_with_free_func (g_free);
+
+        return set;
+}
+
+/* Ungrabs everything that is still grabbed */
+void
+msd_grab_set_free (MsdGrabSet *set)
+{
+        if (set == NULL)
+                return;
+
+        msd_grab_set_begin (set);
+        msd_grab_set_commit (set, set->screens, NULL, NULL);
+
+        g_hash_table_destroy (set->grabbed);
+        g_hash_table_destroy (set->pending);
+        g_ptr_array_free (set->conflicts, TRUE);
+        g_slist_free (set->screens);
+        g_free (set);
+}
+
+/* Starts describing the next set of grabs from scratch */
+void
+msd_grab_set_begin (MsdGrabSet *set)
+{
+        g_hash_table_remove_all (set->pending);
+        g_ptr_array_set_size (set->conflicts, 0);
+}
+
+/* Adds all keycodes of @key to the pending set.  A key that shares a
+ * keycode and modifier state with a key added before it is left out as
+ * a whole and reported as a conflict by msd_grab_set_commit(). */
+void
+msd_grab_set_add (MsdGrabSet *set,
+                  Key        *key,
+                  gpointer    data)
+{
+        guint *code;
+
+        if (key->keycodes == NULL)
+                return;
+
+        for (code = key->keycodes; *code; ++code) {
+                gint64     id = bucket_id (*code, key->state);
+                GrabEntry *other = g_hash_table_lookup (set->pending, &id);
+
+                if (other != NULL && other->owner != key) {
+                        g_ptr_array_add (set->conflicts, grab_entry_new (*code, key->state, key, data));
+                        return;
+                }
+        }
+
+        for (code = key->keycodes; *code; ++code) {
+                GrabEntry *entry = grab_entry_new (*code, key->state, key, data);
+
+                g_hash_table_replace (set->pending, &entry->id, entry);
+        }
+}
+
+#ifdef GDK_WINDOWING_X11
+static GPtrArray    *batch_entries = NULL;
+static gulong        batch_first_serial = 0;
+static XErrorHandler previous_error_handler = NULL;
+
+static int
+grab_error_handler (Display     *display,
+                    XErrorEvent *error)
+{
+        guint i;
+
+        if (error->serial >= batch_first_serial) {
+                for (i = 0; i < batch_entries->len; i++) {
+                        GrabEntry *entry = g_ptr_array_index (batch_entries, i);
+
+                        if (error->serial >= entry->first_serial &&
+                            error->serial <= entry->last_serial) {
+                                entry->denied = TRUE;
+                                return 0;
+                        }
+                }
+
+                /* an ungrab of a key we never got */
+                return 0;
+        }
+
+        return previous_error_handler (display, error);
+}
+#endif /* GDK_WINDOWING_X11 */
+
+/* Makes the grabs match the pending set: only keys that were added or
+ * removed since the last commit are grabbed or ungrabbed, all in one
+ * batch followed by a single round trip.  @failed_func is called for
+ * every key that conflicted with another key of the set or that another
+ * client has already grabbed. */
+void
+msd_grab_set_commit (MsdGrabSet        *set,
+                     GSList            *screens,
+                     MsdGrabFailedFunc  failed_func,
+                     gpointer           user_data)
+{
+#ifdef GDK_WINDOWING_X11
+        GHashTableIter  iter;
+        GrabEntry      *entry;
+        GPtrArray      *added;
+        GHashTable     *reported;
+        Display        *xdpy;
+        guint           n_removed = 0;
+        guint           i;
+
+        if (screens != set->screens) {
+                GSList *copy = g_slist_copy (screens);
+
+                g_slist_free (set->screens);
+                set->screens = copy;
+        }
+
+        if (!GDK_IS_X11_DISPLAY (gdk_display_get_default ()))
+                return;
+
+        xdpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+        added = g_ptr_array_new ();
+        g_hash_table_iter_init (&iter, set->pending);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+                if (!g_hash_table_contains (set->grabbed, &entry->id))
+                        g_ptr_array_add (added, entry);
+        }
+
+        batch_entries = added;
+        batch_first_serial = NextRequest (xdpy);
+        previous_error_handler = XSetErrorHandler (grab_error_handler);
+
+        g_hash_table_iter_init (&iter, set->grabbed);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+                if (!g_hash_table_contains (set->pending, &entry->id)) {
+                        grab_keycodes_unsafe (entry->keycodes, entry->state, FALSE, set->screens);
+                        n_removed++;
+                }
+        }
+
+        for (i = 0; i < added->len; i++) {
+                entry = g_ptr_array_index (added, i);
+                entry->first_serial = NextRequest (xdpy);
+                grab_keycodes_unsafe (entry->keycodes, entry->state, TRUE, set->screens);
+                entry->last_serial = NextRequest (xdpy) - 1;
+        }
+
+        XSync (xdpy, False);
+        XSetErrorHandler (previous_error_handler);
+        batch_entries = NULL;
+
+        g_debug ("keygrab: %u grabs added, %u removed, %u kept",
+                 added->len, n_removed,
+                 g_hash_table_size (set->pending) - added->len);
+
+        /* report each failing key once, even if several keycodes failed */
+        reported = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+        for (i = 0; i < set->conflicts->len; i++) {
+                entry = g_ptr_array_index (set->conflicts, i);
+                if (failed_func != NULL && !g_hash_table_contains (reported, entry->owner)) {
+                        g_hash_table_add (reported, entry->owner);
+                        failed_func (entry->owner, MSD_GRAB_CONFLICT, entry->data, user_data);
+                }
+        }
+
+        for (i = 0; i < added->len; i++) {
+                entry = g_ptr_array_index (added, i);
+                if (!entry->denied)
+                        continue;
+
+                /* some modifier combinations may have been granted */
+                grab_keycodes_unsafe (entry->keycodes, entry->state, FALSE, set->screens);
+
+                if (failed_func != NULL && !g_hash_table_contains (reported, entry->owner)) {
+                        g_hash_table_add (reported, entry->owner);
+                        failed_func (entry->owner, MSD_GRAB_DENIED, entry->data, user_data);
+                }
+                g_hash_table_remove (set->pending, &entry->id);
+        }
+
+        if (n_removed > 0 || added->len > 0)
+                gdk_display_flush (gdk_display_get_default ());
+
+        g_hash_table_destroy (reported);
+        g_ptr_array_free (added, TRUE);
+
+        /* the pending set becomes the grabbed one */
+        g_hash_table_iter_init (&iter, set->pending);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+                entry->owner = NULL;
+
+        {
+                GHashTable *tmp = set->grabbed;
+
+                set->grabbed = set->pending;
+                set->pending = tmp;
+                g_hash_table_remove_all (set->pending);
+        }
+#endif /* GDK_WINDOWING_X11 */
+}
@@ -44,6 +44,40 @@ gboolean        match_key       (Key     *key,
 gboolean        key_uses_keycode (const Key *key,
                                   guint keycode);
 
+typedef struct _MsdKeyTable MsdKeyTable;
+
+MsdKeyTable    *msd_key_table_new        (void);
+void            msd_key_table_free       (MsdKeyTable *table);
+void            msd_key_table_add        (MsdKeyTable *table,
+                                          Key         *key,
+                                          gpointer     data);
+void            msd_key_table_remove_all (MsdKeyTable *table);
+gpointer        msd_key_table_lookup     (MsdKeyTable *table,
+                                          XEvent      *event);
+
+typedef enum {
+        MSD_GRAB_CONFLICT,      /* another key of the same set uses it */
+        MSD_GRAB_DENIED         /* another client has grabbed it */
+} MsdGrabFailure;
+
+typedef void  (*MsdGrabFailedFunc) (Key            *key,
+                                    MsdGrabFailure  reason,
+                                    gpointer        data,
+                                    gpointer        user_data);
+
+typedef struct _MsdGrabSet MsdGrabSet;
+
+MsdGrabSet     *msd_grab_set_new         (void);
+void            msd_grab_set_free        (MsdGrabSet        *set);
+void            msd_grab_set_begin       (MsdGrabSet        *set);
+void            msd_grab_set_add         (MsdGrabSet        *set,
+                                          Key               *key,
+                                          gpointer           data);
+void            msd_grab_set_commit      (MsdGrabSet        *set,
+                                          GSList            *screens,
+                                          MsdGrabFailedFunc  failed_func,
+                                          gpointer           user_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "msd-spawn.h"
+
+static void
+child_exited (GPid     pid,
+              gint     status,
+              gpointer user_data)
+{
+        g_spawn_close_pid (pid);
+}
+
+/**
+ * msd_spawn_async:
+ * @working_directory: (nullable): child's current working directory, or
+ *   %NULL to inherit the daemon's
+ * @argv: child's argument vector, searched for in PATH
+ * @envp: (nullable): child's environment, or %NULL to inherit the daemon's
+ * @error: return location for error
+ *
+ * Launches a command for a user action, like g_spawn_async().
+ *
+ * A plain g_spawn_async() forks twice, copying the page tables of the
+ * whole daemon each time, so its cost grows with the daemon's size.
+ * Here the child is reaped from a child watch and descriptors are not
+ * closed one by one in the child, which lets GLib use posix_spawn():
+ * glibc runs the child in the daemon's address space until it execs.
+ * Nothing leaks into the child because every descriptor the daemon and
+ * its plugins open is close-on-exec; new code must keep it that way
+ * (O_CLOEXEC, g_unix_open_pipe() with FD_CLOEXEC).
+ *
+ * posix_spawn() cannot change directories, so a @working_directory
+ * other than the current one falls back to a regular fork.
+ *
+ * Returns: %TRUE on success, %FALSE if @error is set
+ */
+gboolean
+msd_spawn_async (const gchar  *working_directory,
+                 gchar       **argv,
+                 gchar       **envp,
+                 GError      **error)
+{
+        GPid      pid;
+        gchar    *cwd = NULL;
+        gboolean  retval;
+
+        if (working_directory != NULL) {
+                cwd = g_get_current_dir ();
+                if (g_strcmp0 (cwd, working_directory) == 0)
+                        working_directory = NULL;
+        }
+
+        retval = g_spawn_async (working_directory,
+                                argv,
+                                envp,
+                                G_SPAWN_SEARCH_PATH |
+                                G_SPAWN_DO_NOT_REAP_CHILD |
+                                G_SPAWN_LEAVE_DESCRIPTORS_OPEN,
+                                NULL,
+                                NULL,
+                                &pid,
+                                error);
+        g_free (cwd);
+
+        if (retval)
+                g_child_watch_add (pid, child_exited, NULL);
+
+        return retval;
+}
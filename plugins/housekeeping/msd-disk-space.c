@@ -22,7 +22,7 @@
  *
  */
 
-/* gcc -DHAVE_LIBNOTIFY -DTEST -Wall `pkg-config --cflags --libs gobject-2.0 gio-unix-2.0 glib-2.0 gtk+-2.0 libnotify` -o msd-disk-space-test msd-disk-space.c */
+/* gcc -DHAVE_LIBNOTIFY -DTEST -Wall `pkg-config --cflags --libs gobject-2.0 gio-unix-2.0 glib-2.0 gtk+-2.0 libnotify` -o msd-disk-space-test msd-disk-space.c msd-housekeeping-jobs.c */
 
 #include "config.h"
 
@@ -38,12 +38,16 @@
 #include <gtk/gtk.h>
 
 #include "msd-disk-space.h"
+#include "msd-housekeeping-jobs.h"
 #include "msd-ldsm-dialog.h"
 #include "msd-ldsm-trash-empty.h"
 
 #define GIGABYTE                   1024 * 1024 * 1024
 
-#define CHECK_EVERY_X_SECONDS      60
+#define MIN_CHECK_INTERVAL_SECONDS 60
+#define MAX_CHECK_INTERVAL_SECONDS (15 * 60)
+#define FILL_RATE_SMOOTHING        0.5
+#define STATVFS_TIMEOUT_SECONDS    10
 
 #define DISK_SPACE_ANALYZER        "mate-disk-usage-analyzer"
 
@@ -61,6 +65,26 @@ typedef struct
         time_t notify_time;
 } LdsmMountInfo;
 
+typedef struct
+{
+        LdsmMountInfo info;
+        gboolean ignore;
+        gboolean has_buf;
+        gint64 check_time;
+        gboolean has_rate;
+        gdouble fill_rate;      /* bytes per second, negative when freeing up */
+        gint64 interval;        /* seconds until the check after check_time */
+        gint64 next_check;
+} LdsmMountState;
+
+typedef struct
+{
+        MsdHousekeepingJob *job;
+        gchar *path;
+        struct statvfs buf;
+        gboolean success;
+} LdsmStatvfsJob;
+
 static GHashTable        *ldsm_notified_hash = NULL;
 static unsigned int       ldsm_timeout_id = 0;
 static GUnixMountMonitor *ldsm_monitor = NULL;
@@ -68,10 +92,74 @@ static double             free_percent_notify = 0.05;
 static double             free_percent_notify_again = 0.01;
 static unsigned int       free_size_gb_no_notify = 2;
 static unsigned int       min_notify_period = 10;
-static GSList            *ignore_paths = NULL;
+static GHashTable        *ignore_paths = NULL;
 static GSettings         *settings = NULL;
 static MsdLdsmDialog     *dialog = NULL;
 static guint64           *time_read;
+static GSList            *ldsm_statvfs_jobs = NULL;
+static GHashTable        *ldsm_statvfs_in_flight = NULL;
+static GHashTable        *ldsm_mount_table = NULL;
+
+/* This is borrowed from GLib and used as a way to determine
+ * which mounts we should ignore by default. GLib doesn't
+ * expose this in a way that allows it to be used for this
+ * purpose
+ */
+
+/* We also ignore network filesystems */
+
+static const gchar *ignore_fs[] = {
+        "adfs",
+        "afs",
+        "auto",
+        "autofs",
+        "autofs4",
+        "cifs",
+        "cxfs",
+        "devfs",
+        "devpts",
+        "ecryptfs",
+        "fdescfs",
+        "gfs",
+        "gfs2",
+        "kernfs",
+        "linprocfs",
+        "linsysfs",
+        "lustre",
+        "lustre_lite",
+        "ncpfs",
+        "nfs",
+        "nfs4",
+        "nfsd",
+        "ocfs2",
+        "proc",
+        "procfs",
+        "ptyfs",
+        "rpc_pipefs",
+        "selinuxfs",
+        "smbfs",
+        "sysfs",
+        "tmpfs",
+        "usbfs",
+        "zfs",
+        NULL
+};
+
+static const gchar *ignore_devices[] = {
+        "none",
+        "sunrpc",
+        "devpts",
+        "nfsd",
+        "/dev/loop",
+        "/dev/vn",
+        NULL
+};
+
+/* Looking mounts up in these is constant time, which matters with the
+ * hundreds of overlay and tmpfs mounts found on container hosts.
+ */
+static GHashTable        *ignore_fs_set = NULL;
+static GHashTable        *ignore_devices_set = NULL;
 
 static gchar*
 ldsm_get_fs_id_for_path (const gchar *path)
@@ -263,32 +351,23 @@ ldsm_mount_is_virtual (LdsmMountInfo *mount)
         return FALSE;
 }
 
-static gint
-ldsm_ignore_path_compare (gconstpointer a,
-                          gconstpointer b)
+static GHashTable *
+ldsm_build_set (const gchar *set[])
 {
-        return g_strcmp0 ((const gchar *)a, (const gchar *)b);
-}
+        GHashTable *table;
+        guint i;
 
-static gboolean
-ldsm_mount_is_user_ignore (const gchar *path)
-{
-        if (g_slist_find_custom (ignore_paths, path, (GCompareFunc) ldsm_ignore_path_compare) != NULL)
-                return TRUE;
-        else
-                return FALSE;
+        table = g_hash_table_new (g_str_hash, g_str_equal);
+        for (i = 0; set[i] != NULL; i++)
+                g_hash_table_add (table, (gpointer) set[i]);
+
+        return table;
 }
 
 static gboolean
-is_in (const gchar *value, const gchar *set[])
+ldsm_mount_is_user_ignore (const gchar *path)
 {
-        int i;
-        for (i = 0; set[i] != NULL; i++)
-        {
-              if (strcmp (set[i], value) == 0)
-                return TRUE;
-        }
-        return FALSE;
+        return g_hash_table_contains (ignore_paths, path);
 }
 
 static gboolean
@@ -300,67 +379,13 @@ ldsm_mount_should_ignore (GUnixMountEntry *mount)
         if (ldsm_mount_is_user_ignore (path))
                 return TRUE;
 
-        /* This is borrowed from GLib and used as a way to determine
-         * which mounts we should ignore by default. GLib doesn't
-         * expose this in a way that allows it to be used for this
-         * purpose
-         */
-
-        /* We also ignore network filesystems */
-
-        const gchar *ignore_fs[] = {
-                "adfs",
-                "afs",
-                "auto",
-                "autofs",
-                "autofs4",
-                "cifs",
-                "cxfs",
-                "devfs",
-                "devpts",
-                "ecryptfs",
-                "fdescfs",
-                "gfs",
-                "gfs2",
-                "kernfs",
-                "linprocfs",
-                "linsysfs",
-                "lustre",
-                "lustre_lite",
-                "ncpfs",
-                "nfs",
-                "nfs4",
-                "nfsd",
-                "ocfs2",
-                "proc",
-                "procfs",
-                "ptyfs",
-                "rpc_pipefs",
-                "selinuxfs",
-                "smbfs",
-                "sysfs",
-                "tmpfs",
-                "usbfs",
-                "zfs",
-                NULL
-        };
-        const gchar *ignore_devices[] = {
-                "none",
-                "sunrpc",
-                "devpts",
-                "nfsd",
-                "/dev/loop",
-                "/dev/vn",
-                NULL
-        };
-
         fs = g_unix_mount_get_fs_type (mount);
         device = g_unix_mount_get_device_path (mount);
 
-        if (is_in (fs, ignore_fs))
+        if (g_hash_table_contains (ignore_fs_set, fs))
                 return TRUE;
 
-        if (is_in (device, ignore_devices))
+        if (g_hash_table_contains (ignore_devices_set, device))
                 return TRUE;
 
         return FALSE;
@@ -443,82 +468,114 @@ ldsm_maybe_warn_mounts (GList *mounts,
         }
 }
 
-static gboolean
-ldsm_check_all_mounts (gpointer data)
+static gdouble
+ldsm_free_bytes (const struct statvfs *buf)
 {
-        GList *mounts;
-        GList *l;
-        GList *check_mounts = NULL;
-        GList *full_mounts = NULL;
-        guint number_of_mounts;
-        guint number_of_full_mounts;
-        gboolean multiple_volumes = FALSE;
-        gboolean other_usable_volumes = FALSE;
+        return (gdouble) buf->f_frsize * (gdouble) buf->f_bavail;
+}
 
-        /* We iterate through the static mounts in /etc/fstab first, seeing if
-         * they're mounted by checking if the GUnixMountPoint has a corresponding GUnixMountEntry.
-         * Iterating through the static mounts means we automatically ignore dynamically mounted media.
+/* How long until the mount should be looked at again. Mounts that are
+ * far from the notification threshold at their current fill rate are
+ * checked rarely; the interval shrinks as they get closer. Until a fill
+ * rate is known the mount is checked as often as possible, and a mount
+ * that is not filling up backs off gradually, so that a single sample
+ * cannot push it to the maximum interval.
+ */
+static gint64
+ldsm_mount_get_check_interval (LdsmMountState *state)
+{
+        gdouble threshold;
+        gdouble headroom;
+        gdouble interval;
+
+        /* ldsm_mount_has_space() needs both the percentage and the absolute
+         * amount of free space to be under their limits.
          */
-        mounts = g_unix_mount_points_get (time_read);
+        threshold = MIN (free_percent_notify * (gdouble) state->info.buf.f_frsize * (gdouble) state->info.buf.f_blocks,
+                         (gdouble) free_size_gb_no_notify * GIGABYTE);
+        headroom = ldsm_free_bytes (&state->info.buf) - threshold;
 
-        for (l = mounts; l != NULL; l = l->next) {
-                GUnixMountPoint *mount_point = l->data;
-                GUnixMountEntry *mount;
-                LdsmMountInfo *mount_info;
-                const gchar *path;
+        if (headroom <= 0 || !state->has_rate)
+                return MIN_CHECK_INTERVAL_SECONDS;
 
-                path = g_unix_mount_point_get_mount_path (mount_point);
-                mount = g_unix_mount_at (path, time_read);
-                g_unix_mount_point_free (mount_point);
-                if (mount == NULL) {
-                        /* The GUnixMountPoint is not mounted */
-                        continue;
-                }
+        if (state->fill_rate <= 0)
+                return MIN (MAX (state->interval, MIN_CHECK_INTERVAL_SECONDS) * 2,
+                            MAX_CHECK_INTERVAL_SECONDS);
 
-                mount_info = g_new0 (LdsmMountInfo, 1);
-                mount_info->mount = mount;
+        /* Look again halfway to the predicted crossing */
+        interval = headroom / state->fill_rate / 2;
 
-                path = g_unix_mount_get_mount_path (mount);
+        return (gint64) CLAMP (interval, MIN_CHECK_INTERVAL_SECONDS, MAX_CHECK_INTERVAL_SECONDS);
+}
 
-                if (g_unix_mount_is_readonly (mount)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+static void
+ldsm_mount_update (LdsmMountState       *state,
+                   const struct statvfs *buf,
+                   gint64                now)
+{
+        if (state->has_buf && now > state->check_time) {
+                gdouble elapsed;
+                gdouble rate;
+
+                elapsed = (gdouble) (now - state->check_time) / G_USEC_PER_SEC;
+                rate = (ldsm_free_bytes (&state->info.buf) - ldsm_free_bytes (buf)) / elapsed;
+                if (state->has_rate)
+                        state->fill_rate = FILL_RATE_SMOOTHING * rate + (1 - FILL_RATE_SMOOTHING) * state->fill_rate;
+                else
+                        state->fill_rate = rate;
+                state->has_rate = TRUE;
+        }
 
-                if (ldsm_mount_should_ignore (mount)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        state->info.buf = *buf;
+        state->has_buf = TRUE;
+        state->check_time = now;
 
-                if (statvfs (path, &mount_info->buf) != 0) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        if (ldsm_mount_is_virtual (&state->info)) {
+                /* It won't fill up, no need to look at it again */
+                state->next_check = G_MAXINT64;
+                return;
+        }
 
-                if (ldsm_mount_is_virtual (mount_info)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        state->interval = ldsm_mount_get_check_interval (state);
+        state->next_check = now + state->interval * G_USEC_PER_SEC;
+}
 
-                check_mounts = g_list_prepend (check_mounts, mount_info);
-        }
-        g_list_free (mounts);
+static void
+ldsm_check_finish (void)
+{
+        GHashTableIter iter;
+        gpointer value;
+        GList *full_mounts = NULL;
+        guint number_of_mounts = 0;
+        guint number_of_full_mounts;
+        gboolean multiple_volumes = FALSE;
+        gboolean other_usable_volumes = FALSE;
 
-        number_of_mounts = g_list_length (check_mounts);
-        if (number_of_mounts > 1)
-                multiple_volumes = TRUE;
+        /* Mounts that weren't due for a check count with their last known state */
+        g_hash_table_iter_init (&iter, ldsm_mount_table);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LdsmMountState *state = value;
 
-        for (l = check_mounts; l != NULL; l = l->next) {
-                LdsmMountInfo *mount_info = l->data;
+                if (state->ignore || !state->has_buf || ldsm_mount_is_virtual (&state->info))
+                        continue;
 
-                if (!ldsm_mount_has_space (mount_info)) {
+                number_of_mounts++;
+
+                if (!ldsm_mount_has_space (&state->info)) {
+                        LdsmMountInfo *mount_info;
+
+                        mount_info = g_new0 (LdsmMountInfo, 1);
+                        mount_info->mount = g_unix_mount_copy (state->info.mount);
+                        mount_info->buf = state->info.buf;
                         full_mounts = g_list_prepend (full_mounts, mount_info);
                 } else {
-                        g_hash_table_remove (ldsm_notified_hash, g_unix_mount_get_mount_path (mount_info->mount));
-                        ldsm_free_mount_info (mount_info);
+                        g_hash_table_remove (ldsm_notified_hash, g_unix_mount_get_mount_path (state->info.mount));
                 }
         }
 
+        if (number_of_mounts > 1)
+                multiple_volumes = TRUE;
+
         number_of_full_mounts = g_list_length (full_mounts);
         if (number_of_mounts > number_of_full_mounts)
                 other_usable_volumes = TRUE;
@@ -526,52 +583,285 @@ ldsm_check_all_mounts (gpointer data)
         ldsm_maybe_warn_mounts (full_mounts, multiple_volumes,
                                 other_usable_volumes);
 
-        g_list_free (check_mounts);
         g_list_free (full_mounts);
+}
+
+static gboolean ldsm_check_timeout_cb (gpointer data);
+
+static void
+ldsm_schedule_check (void)
+{
+        GHashTableIter iter;
+        gpointer value;
+        gint64 next_check = G_MAXINT64;
+        gint64 delay;
+
+        if (ldsm_timeout_id) {
+                g_source_remove (ldsm_timeout_id);
+                ldsm_timeout_id = 0;
+        }
+
+        g_hash_table_iter_init (&iter, ldsm_mount_table);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LdsmMountState *state = value;
+
+                next_check = MIN (next_check, state->next_check);
+        }
 
-        return TRUE;
+        /* Nothing to watch until the mounts change */
+        if (next_check == G_MAXINT64)
+                return;
+
+        delay = next_check - g_get_monotonic_time ();
+        delay = MAX (delay, 0);
+
+        ldsm_timeout_id = g_timeout_add_seconds ((guint) ((delay + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC),
+                                                 ldsm_check_timeout_cb, NULL);
+}
+
+/* Worker thread */
+static void
+ldsm_statvfs_run (GCancellable *cancellable G_GNUC_UNUSED,
+                  gpointer      data)
+{
+        LdsmStatvfsJob *job = data;
+
+        job->success = (statvfs (job->path, &job->buf) == 0);
+}
+
+static void
+ldsm_statvfs_done (gboolean completed,
+                   gpointer data)
+{
+        LdsmStatvfsJob *job = data;
+        LdsmMountState *state;
+        gint64 now;
+
+        ldsm_statvfs_jobs = g_slist_remove (ldsm_statvfs_jobs, job->job);
+
+        /* The mount may have gone away in the meantime */
+        state = g_hash_table_lookup (ldsm_mount_table, job->path);
+        now = g_get_monotonic_time ();
+
+        if (state != NULL) {
+                if (!completed) {
+                        g_debug ("housekeeping: statvfs on %s timed out, skipping it", job->path);
+                        state->next_check = now + MIN_CHECK_INTERVAL_SECONDS * G_USEC_PER_SEC;
+                } else if (!job->success) {
+                        state->next_check = now + MIN_CHECK_INTERVAL_SECONDS * G_USEC_PER_SEC;
+                } else {
+                        ldsm_mount_update (state, &job->buf, now);
+                }
+        }
+
+        if (ldsm_statvfs_jobs == NULL) {
+                ldsm_check_finish ();
+                ldsm_schedule_check ();
+        }
+}
+
+static void
+ldsm_statvfs_free (gpointer data)
+{
+        LdsmStatvfsJob *job = data;
+
+        /* The worker is done with this mount, it may be checked again */
+        if (ldsm_statvfs_in_flight != NULL)
+                g_hash_table_remove (ldsm_statvfs_in_flight, job->path);
+
+        g_free (job->path);
+        g_free (job);
+}
+
+static void
+ldsm_check_due_mounts (void)
+{
+        GHashTableIter iter;
+        gpointer key, value;
+        gint64 now;
+
+        /* The current check reschedules once every mount has answered */
+        if (ldsm_statvfs_jobs != NULL)
+                return;
+
+        now = g_get_monotonic_time ();
+
+        g_hash_table_iter_init (&iter, ldsm_mount_table);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                LdsmMountState *state = value;
+                const gchar *path = key;
+                LdsmStatvfsJob *job;
+
+                if (state->next_check > now)
+                        continue;
+
+                /* A statvfs from an earlier check never came back, don't
+                 * tie up another worker with this mount.
+                 */
+                if (g_hash_table_contains (ldsm_statvfs_in_flight, path)) {
+                        state->next_check = now + MIN_CHECK_INTERVAL_SECONDS * G_USEC_PER_SEC;
+                        continue;
+                }
+
+                /* statvfs blocks for as long as the server does on network
+                 * and removable filesystems, so it is done in a worker.
+                 */
+                job = g_new0 (LdsmStatvfsJob, 1);
+                job->path = g_strdup (path);
+                g_hash_table_add (ldsm_statvfs_in_flight, g_strdup (path));
+
+                job->job = msd_housekeeping_job_run (ldsm_statvfs_run,
+                                                     ldsm_statvfs_done,
+                                                     job,
+                                                     ldsm_statvfs_free,
+                                                     STATVFS_TIMEOUT_SECONDS);
+                ldsm_statvfs_jobs = g_slist_prepend (ldsm_statvfs_jobs, job->job);
+        }
+
+        if (ldsm_statvfs_jobs == NULL)
+                ldsm_schedule_check ();
+}
+
+static gboolean
+ldsm_check_timeout_cb (gpointer data G_GNUC_UNUSED)
+{
+        ldsm_timeout_id = 0;
+        ldsm_check_due_mounts ();
+
+        return FALSE;
 }
 
 static gboolean
 ldsm_is_hash_item_not_in_mounts (gpointer key,
-                                 gpointer value,
+                                 gpointer value G_GNUC_UNUSED,
                                  gpointer user_data)
 {
-        GList *l;
-
-        for (l = (GList *) user_data; l != NULL; l = l->next) {
-                GUnixMountEntry *mount = l->data;
-                const char *path;
+        return !g_hash_table_contains ((GHashTable *) user_data, key);
+}
 
-                path = g_unix_mount_get_mount_path (mount);
+static void
+ldsm_free_mount_state (gpointer data)
+{
+        LdsmMountState *state = data;
 
-                if (strcmp (path, key) == 0)
-                        return FALSE;
-        }
+        g_unix_mount_free (state->info.mount);
+        g_free (state);
+}
 
-        return TRUE;
+static gboolean
+ldsm_mount_classify (GUnixMountEntry *mount)
+{
+        return g_unix_mount_is_readonly (mount) || ldsm_mount_should_ignore (mount);
 }
 
+/* Brings the table of mounts to watch in line with the system, keeping
+ * what we learned about the mounts that are still there. New mounts are
+ * first checked at @first_check.
+ *
+ * Mounts we ignore stay in the table too, so that an unchanged mount
+ * entry doesn't have to be classified again; @reclassify forces it when
+ * the ignore list changed.
+ */
 static void
-ldsm_mounts_changed (GObject  *monitor G_GNUC_UNUSED,
-                     gpointer  data G_GNUC_UNUSED)
+ldsm_update_mount_table (gint64   first_check,
+                         gboolean reclassify)
 {
         GList *mounts;
+        GList *points;
+        GList *l;
+        GHashTable *mounts_by_path;
+        GHashTable *mount_table;
 
-        /* remove the saved data for mounts that got removed */
         mounts = g_unix_mounts_get (time_read);
+        mounts_by_path = g_hash_table_new (g_str_hash, g_str_equal);
+        for (l = mounts; l != NULL; l = l->next)
+                g_hash_table_insert (mounts_by_path,
+                                     (gpointer) g_unix_mount_get_mount_path (l->data),
+                                     l->data);
+
+        /* remove the saved data for mounts that got removed */
         g_hash_table_foreach_remove (ldsm_notified_hash,
-                                     ldsm_is_hash_item_not_in_mounts, mounts);
+                                     ldsm_is_hash_item_not_in_mounts, mounts_by_path);
+
+        mount_table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, ldsm_free_mount_state);
+
+        /* We iterate through the static mounts in /etc/fstab first, seeing if
+         * they're mounted by checking if the GUnixMountPoint has a corresponding GUnixMountEntry.
+         * Iterating through the static mounts means we automatically ignore dynamically mounted media.
+         */
+        points = g_unix_mount_points_get (time_read);
+
+        for (l = points; l != NULL; l = l->next) {
+                GUnixMountPoint *mount_point = l->data;
+                GUnixMountEntry *mount;
+                LdsmMountState *state;
+                gpointer key;
+                const gchar *path;
+
+                path = g_unix_mount_point_get_mount_path (mount_point);
+                mount = g_hash_table_lookup (mounts_by_path, path);
+                if (mount == NULL) {
+                        /* The GUnixMountPoint is not mounted */
+                        continue;
+                }
+
+                path = g_unix_mount_get_mount_path (mount);
+                if (g_hash_table_contains (mount_table, path))
+                        continue;
+
+                if (g_hash_table_steal_extended (ldsm_mount_table, path, &key, (gpointer *) &state)) {
+                        if (g_unix_mount_compare (state->info.mount, mount) != 0) {
+                                /* Something else got mounted there, start over */
+                                g_unix_mount_free (state->info.mount);
+                                state->info.mount = g_unix_mount_copy (mount);
+                                state->ignore = ldsm_mount_classify (mount);
+                                state->has_buf = FALSE;
+                                state->has_rate = FALSE;
+                                state->fill_rate = 0;
+                                state->interval = 0;
+                                state->next_check = first_check;
+                        } else if (reclassify) {
+                                gboolean ignore = ldsm_mount_classify (mount);
+
+                                if (ignore != state->ignore) {
+                                        state->ignore = ignore;
+                                        state->has_buf = FALSE;
+                                        state->has_rate = FALSE;
+                                        state->fill_rate = 0;
+                                        state->interval = 0;
+                                        state->next_check = first_check;
+                                }
+                        }
+                } else {
+                        key = g_strdup (path);
+                        state = g_new0 (LdsmMountState, 1);
+                        state->info.mount = g_unix_mount_copy (mount);
+                        state->ignore = ldsm_mount_classify (mount);
+                        state->next_check = first_check;
+                }
+
+                if (state->ignore)
+                        state->next_check = G_MAXINT64;
+
+                g_hash_table_insert (mount_table, key, state);
+        }
+
+        g_list_free_full (points, (GDestroyNotify) g_unix_mount_point_free);
+        g_hash_table_destroy (mounts_by_path);
         g_list_free_full (mounts, (GDestroyNotify) g_unix_mount_free);
 
-        /* check the status now, for the new mounts */
-        ldsm_check_all_mounts (NULL);
+        g_hash_table_destroy (ldsm_mount_table);
+        ldsm_mount_table = mount_table;
+}
 
-        /* and reset the timeout */
-        if (ldsm_timeout_id)
-                g_source_remove (ldsm_timeout_id);
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+static void
+ldsm_mounts_changed (GObject  *monitor G_GNUC_UNUSED,
+                     gpointer  data G_GNUC_UNUSED)
+{
+        /* only the mounts that are new or changed get checked right away */
+        ldsm_update_mount_table (0, FALSE);
+        ldsm_check_due_mounts ();
 }
 
 static gboolean
@@ -610,10 +900,7 @@ msd_ldsm_get_config (void)
         min_notify_period = g_settings_get_int (settings,
                                                 SETTINGS_MIN_NOTIFY_PERIOD);
 
-        if (ignore_paths != NULL) {
-                g_slist_free_full (ignore_paths, g_free);
-                ignore_paths = NULL;
-        }
+        g_hash_table_remove_all (ignore_paths);
 
         settings_list = g_settings_get_strv (settings, SETTINGS_IGNORE_PATHS);
         if (settings_list != NULL) {
@@ -621,7 +908,7 @@ msd_ldsm_get_config (void)
 
                 for (i = 0; settings_list[i] != NULL; i++) {
                         if (settings_list[i] != NULL)
-                                ignore_paths = g_slist_prepend (ignore_paths, g_strdup (settings_list[i]));
+                                g_hash_table_add (ignore_paths, g_strdup (settings_list[i]));
                 }
 
                 /* Make sure we dont leave stale entries in ldsm_notified_hash */
@@ -638,7 +925,25 @@ msd_ldsm_update_config (GSettings *gsettings G_GNUC_UNUSED,
                         gchar *key G_GNUC_UNUSED,
                         gpointer user_data G_GNUC_UNUSED)
 {
+        GHashTableIter iter;
+        gpointer value;
+
         msd_ldsm_get_config ();
+
+        /* The ignore list and thresholds may have changed; replan from what
+         * is already known rather than checking everything again.
+         */
+        ldsm_update_mount_table (0, TRUE);
+
+        g_hash_table_iter_init (&iter, ldsm_mount_table);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LdsmMountState *state = value;
+
+                if (!state->ignore && state->has_buf && !ldsm_mount_is_virtual (&state->info))
+                        state->next_check = state->check_time + ldsm_mount_get_check_interval (state) * G_USEC_PER_SEC;
+        }
+
+        ldsm_check_due_mounts ();
 }
 
 void
@@ -652,6 +957,12 @@ msd_ldsm_setup (gboolean check_now)
         ldsm_notified_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                     g_free,
                                                     ldsm_free_mount_info);
+        ldsm_statvfs_in_flight = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, NULL);
+
+        ignore_fs_set = ldsm_build_set (ignore_fs);
+        ignore_devices_set = ldsm_build_set (ignore_devices);
+        ignore_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
         settings = g_settings_new (SETTINGS_HOUSEKEEPING_SCHEMA);
         msd_ldsm_get_config ();
@@ -661,12 +972,18 @@ msd_ldsm_setup (gboolean check_now)
         g_signal_connect (ldsm_monitor, "mounts-changed",
                           G_CALLBACK (ldsm_mounts_changed), NULL);
 
-        if (check_now)
-                ldsm_check_all_mounts (NULL);
+        g_signal_connect (ldsm_monitor, "mountpoints-changed",
+                          G_CALLBACK (ldsm_mounts_changed), NULL);
 
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+        ldsm_mount_table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free, ldsm_free_mount_state);
 
+        if (check_now)
+                ldsm_update_mount_table (0, FALSE);
+        else
+                ldsm_update_mount_table (g_get_monotonic_time () + MIN_CHECK_INTERVAL_SECONDS * G_USEC_PER_SEC, FALSE);
+
+        ldsm_check_due_mounts ();
 }
 
 void
@@ -676,6 +993,18 @@ msd_ldsm_clean (void)
                 g_source_remove (ldsm_timeout_id);
         ldsm_timeout_id = 0;
 
+        /* Workers stuck in statvfs release their data whenever they return */
+        g_slist_free_full (ldsm_statvfs_jobs, (GDestroyNotify) msd_housekeeping_job_cancel);
+        ldsm_statvfs_jobs = NULL;
+
+        if (ldsm_statvfs_in_flight)
+                g_hash_table_destroy (ldsm_statvfs_in_flight);
+        ldsm_statvfs_in_flight = NULL;
+
+        if (ldsm_mount_table)
+                g_hash_table_destroy (ldsm_mount_table);
+        ldsm_mount_table = NULL;
+
         if (ldsm_notified_hash)
                 g_hash_table_destroy (ldsm_notified_hash);
         ldsm_notified_hash = NULL;
@@ -694,7 +1023,18 @@ msd_ldsm_clean (void)
         }
 
         if (ignore_paths) {
-                g_slist_free_full (ignore_paths, g_free);
+                g_hash_table_destroy (ignore_paths);
+                ignore_paths = NULL;
+        }
+
+        if (ignore_fs_set) {
+                g_hash_table_destroy (ignore_fs_set);
+                ignore_fs_set = NULL;
+        }
+
+        if (ignore_devices_set) {
+                g_hash_table_destroy (ignore_devices_set);
+                ignore_devices_set = NULL;
         }
 }
 
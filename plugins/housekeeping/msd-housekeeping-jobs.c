@@ -0,0 +1,186 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Small job engine for the housekeeping plugin.
+ *
+ * Directory scans, unlinks and statvfs calls can block for a long time on
+ * network filesystems, so they are run on a bounded thread pool owned by
+ * this plugin rather than in the main loop (or GLib's shared pool, which
+ * the rest of the daemon relies on for async I/O).
+ *
+ * Every job has its own GCancellable and an optional timeout. When the
+ * timeout expires the job is cancelled and its done callback is invoked
+ * right away with @completed set to FALSE; the worker may still be stuck
+ * in a system call at that point, so the done callback must not look at
+ * anything the worker writes. The destroy notify for the job data is only
+ * called once the worker has returned, and always from the main loop.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "msd-housekeeping-jobs.h"
+
+#define MAX_WORKER_THREADS 4
+
+struct _MsdHousekeepingJob {
+        MsdHousekeepingJobFunc      func;
+        MsdHousekeepingJobDoneFunc  done;
+        gpointer                    user_data;
+        GDestroyNotify              destroy;
+        GCancellable               *cancellable;
+        guint                       timeout_id;
+
+        /* Only accessed from the main loop */
+        gboolean                    finished;
+        gboolean                    returned;
+};
+
+static GThreadPool *job_pool = NULL;
+
+static void
+job_free (MsdHousekeepingJob *job)
+{
+        if (job->destroy != NULL)
+                job->destroy (job->user_data);
+
+        g_object_unref (job->cancellable);
+        g_free (job);
+}
+
+static void
+job_finish (MsdHousekeepingJob *job,
+            gboolean            completed)
+{
+        if (job->finished)
+                return;
+
+        job->finished = TRUE;
+
+        if (job->timeout_id != 0) {
+                g_source_remove (job->timeout_id);
+                job->timeout_id = 0;
+        }
+
+        if (job->done != NULL)
+                job->done (completed, job->user_data);
+}
+
+static gboolean
+job_returned_idle (gpointer data)
+{
+        MsdHousekeepingJob *job = data;
+
+        job->returned = TRUE;
+        job_finish (job, !g_cancellable_is_cancelled (job->cancellable));
+        job_free (job);
+
+        return FALSE;
+}
+
+static gboolean
+job_timeout_cb (gpointer data)
+{
+        MsdHousekeepingJob *job = data;
+
+        g_debug ("housekeeping: job timed out");
+
+        job->timeout_id = 0;
+        g_cancellable_cancel (job->cancellable);
+        job_finish (job, FALSE);
+
+        return FALSE;
+}
+
+/* Worker thread */
+static void
+job_thread_func (gpointer data,
+                 gpointer user_data G_GNUC_UNUSED)
+{
+        MsdHousekeepingJob *job = data;
+
+        if (!g_cancellable_is_cancelled (job->cancellable))
+                job->func (job->cancellable, job->user_data);
+
+        g_idle_add (job_returned_idle, job);
+}
+
+/**
+ * msd_housekeeping_job_run:
+ *
+ * Queues @func to be run in a worker thread. Once it has returned, @done is
+ * called from the main loop, unless the job timed out after @timeout seconds
+ * (0 for none) or was cancelled before that.
+ *
+ * The returned job is only valid until @done has been called or
+ * msd_housekeeping_job_cancel() was used on it.
+ */
+MsdHousekeepingJob *
+msd_housekeeping_job_run (MsdHousekeepingJobFunc      func,
+                          MsdHousekeepingJobDoneFunc  done,
+                          gpointer                    user_data,
+                          GDestroyNotify              destroy,
+                          guint                       timeout)
+{
+        MsdHousekeepingJob *job;
+
+        g_return_val_if_fail (func != NULL, NULL);
+
+        if (job_pool == NULL)
+                job_pool = g_thread_pool_new (job_thread_func, NULL,
+                                              MAX_WORKER_THREADS, FALSE, NULL);
+
+        job = g_new0 (MsdHousekeepingJob, 1);
+        job->func = func;
+        job->done = done;
+        job->user_data = user_data;
+        job->destroy = destroy;
+        job->cancellable = g_cancellable_new ();
+
+        if (timeout > 0)
+                job->timeout_id = g_timeout_add_seconds (timeout, job_timeout_cb, job);
+
+        g_thread_pool_push (job_pool, job, NULL);
+
+        return job;
+}
+
+/**
+ * msd_housekeeping_job_cancel:
+ *
+ * Cancels @job; its done callback will not be called. The job data is
+ * still released once the worker has returned.
+ */
+void
+msd_housekeeping_job_cancel (MsdHousekeepingJob *job)
+{
+        g_return_if_fail (job != NULL);
+        g_return_if_fail (!job->finished);
+
+        g_cancellable_cancel (job->cancellable);
+
+        job->finished = TRUE;
+        if (job->timeout_id != 0) {
+                g_source_remove (job->timeout_id);
+                job->timeout_id = 0;
+        }
+}
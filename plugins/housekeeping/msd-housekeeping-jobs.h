@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __MSD_HOUSEKEEPING_JOBS_H
+#define __MSD_HOUSEKEEPING_JOBS_H
+
+#include <gio/gio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _MsdHousekeepingJob MsdHousekeepingJob;
+
+/* Runs in a worker thread */
+typedef void (*MsdHousekeepingJobFunc)     (GCancellable *cancellable,
+                                            gpointer      user_data);
+/* Runs in the main loop; @completed is FALSE if the job timed out */
+typedef void (*MsdHousekeepingJobDoneFunc) (gboolean      completed,
+                                            gpointer      user_data);
+
+MsdHousekeepingJob *msd_housekeeping_job_run    (MsdHousekeepingJobFunc      func,
+                                                 MsdHousekeepingJobDoneFunc  done,
+                                                 gpointer                    user_data,
+                                                 GDestroyNotify              destroy,
+                                                 guint                       timeout);
+void                msd_housekeeping_job_cancel (MsdHousekeepingJob         *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MSD_HOUSEKEEPING_JOBS_H */
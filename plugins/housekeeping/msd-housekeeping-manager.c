@@ -22,12 +22,11 @@
 #include "config.h"
 
 #include <gio/gio.h>
-#include <glib/gstdio.h>
-#include <string.h>
 
 #include "mate-settings-profile.h"
 #include "msd-housekeeping-manager.h"
 #include "msd-disk-space.h"
+#include "msd-thumbnail-index.h"
 
 /* General */
 #define INTERVAL_ONCE_A_DAY 24*60*60
@@ -45,169 +44,85 @@ struct _MsdHousekeepingManager {
         guint      short_term_cb;
         GSettings *settings;
         gulong     config_listener_id;
+
+        MsdThumbnailIndex *thumb_index;
 };
 
 G_DEFINE_TYPE (MsdHousekeepingManager, msd_housekeeping_manager, G_TYPE_OBJECT)
 
 static gpointer manager_object = NULL;
 
-typedef struct {
-        GDateTime *now;
-        GTimeSpan  max_age;
-        goffset    total_size;
-        goffset    max_size;
-} PurgeData;
-
-typedef struct {
-        GDateTime *mtime;
-        char      *path;
-        glong      size;
-} ThumbData;
-
-static void
-thumb_data_free (gpointer data)
-{
-        ThumbData *info = data;
-
-        if (info) {
-                g_free (info->path);
-                g_date_time_unref (info->mtime);
-                g_free (info);
-        }
-}
-
-static GList *
-read_dir_for_purge (const char *path, GList *files)
-{
-        GFile           *read_path;
-        GFileEnumerator *enum_dir;
-
-        read_path = g_file_new_for_path (path);
-        enum_dir = g_file_enumerate_children (read_path,
-                                              G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                              G_FILE_ATTRIBUTE_TIME_MODIFIED ","
-                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                              G_FILE_QUERY_INFO_NONE,
-                                              NULL,
-                                              NULL);
-
-        if (enum_dir != NULL) {
-                GFileInfo *info;
-                while ((info = g_file_enumerator_next_file (enum_dir, NULL, NULL)) != NULL) {
-                        const char *name;
-                        name = g_file_info_get_name (info);
-
-                        if (strlen (name) == 36 && strcmp (name + 32, ".png") == 0) {
-                                ThumbData *td;
-                                GFile     *entry;
-                                char      *entry_path;
-
-                                entry = g_file_get_child (read_path, name);
-                                entry_path = g_file_get_path (entry);
-                                g_object_unref (entry);
-
-                                td = g_new0 (ThumbData, 1);
-                                td->path = entry_path;
-#if GLIB_CHECK_VERSION(2,61,2)
-                                td->mtime = g_file_info_get_modification_date_time (info);
-#else
-                                GTimeVal mod_time_tv;
-                                g_file_info_get_modification_time (info, &mod_time_tv);
-                                td->mtime = g_date_time_new_from_unix_local ((gint64) mod_time_tv.tv_sec);
-#endif
-                                td->size = g_file_info_get_size (info);
-
-                                files = g_list_prepend (files, td);
-                        }
-                        g_object_unref (info);
-                }
-                g_object_unref (enum_dir);
-        }
-        g_object_unref (read_path);
-
-        return files;
-}
-
-static void
-purge_old_thumbnails (ThumbData *info, PurgeData *purge_data)
+static MsdThumbnailIndex *
+create_thumbnail_index (void)
 {
-        if (g_date_time_difference (purge_data->now, info->mtime) > purge_data->max_age) {
-                g_unlink (info->path);
-                info->size = 0;
-        } else {
-                purge_data->total_size += info->size;
-        }
-}
-
-static gint
-sort_file_mtime (ThumbData *file1, ThumbData *file2)
-{
-        return g_date_time_compare (file1->mtime, file2->mtime);
+        MsdThumbnailIndex *index;
+        gchar             *index_file;
+        gchar             *dirs[4];
+        guint              i;
+
+        dirs[0] = g_build_filename (g_get_user_cache_dir (),
+                                    "thumbnails",
+                                    "normal",
+                                    NULL);
+        dirs[1] = g_build_filename (g_get_user_cache_dir (),
+                                    "thumbnails",
+                                    "large",
+                                    NULL);
+        dirs[2] = g_build_filename (g_get_user_cache_dir (),
+                                    "thumbnails",
+                                    "fail",
+                                    "mate-thumbnail-factory",
+                                    NULL);
+        dirs[3] = NULL;
+
+        index_file = g_build_filename (g_get_user_cache_dir (),
+                                       "mate-settings-daemon",
+                                       "thumbnail-index",
+                                       NULL);
+        index = msd_thumbnail_index_new (index_file, (const gchar * const *) dirs);
+        g_free (index_file);
+
+        for (i = 0; dirs[i] != NULL; i++)
+                g_free (dirs[i]);
+
+        return index;
 }
 
 static void
-purge_thumbnail_cache (MsdHousekeepingManager *manager)
+purge_thumbnail_cache (MsdHousekeepingManager *manager,
+                       gboolean                sync)
 {
-
-        char      *path;
-        GList     *files;
-        PurgeData  purge_data;
+        GTimeSpan max_age;
+        goffset   max_size;
 
         g_debug ("housekeeping: checking thumbnail cache size and freshness");
 
-        purge_data.max_age = g_settings_get_int (manager->settings, THUMB_CACHE_KEY_AGE) * G_TIME_SPAN_DAY;
-        purge_data.max_size = g_settings_get_int (manager->settings, THUMB_CACHE_KEY_SIZE) * 1024 * 1024;
+        max_age = g_settings_get_int (manager->settings, THUMB_CACHE_KEY_AGE) * G_TIME_SPAN_DAY;
+        max_size = (goffset) g_settings_get_int (manager->settings, THUMB_CACHE_KEY_SIZE) * 1024 * 1024;
 
         /* if both are set to -1, we don't need to read anything */
-        if ((purge_data.max_age < 0) && (purge_data.max_size < 0))
+        if ((max_age < 0) && (max_size < 0))
                 return;
 
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "normal",
-                                 NULL);
-        files = read_dir_for_purge (path, NULL);
-        g_free (path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "large",
-                                 NULL);
-        files = read_dir_for_purge (path, files);
-        g_free (path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "fail",
-                                 "mate-thumbnail-factory",
-                                 NULL);
-        files = read_dir_for_purge (path, files);
-        g_free (path);
-
-        purge_data.now = g_date_time_new_now_local ();
-        purge_data.total_size = 0;
-
-        if (purge_data.max_age >= 0)
-                g_list_foreach (files, (GFunc) purge_old_thumbnails, &purge_data);
-
-        if ((purge_data.total_size > purge_data.max_size) && (purge_data.max_size >= 0)) {
-                GList *scan;
-                files = g_list_sort (files, (GCompareFunc) sort_file_mtime);
-                for (scan = files; scan && (purge_data.total_size > purge_data.max_size); scan = scan->next) {
-                        ThumbData *info = scan->data;
-                        g_unlink (info->path);
-                        purge_data.total_size -= info->size;
-                }
-        }
-
-        g_list_free_full (files, thumb_data_free);
-        g_date_time_unref (purge_data.now);
+        /* The index is only built the first time it is needed, it is kept
+         * up to date by file monitors after that.
+         */
+        if (manager->thumb_index == NULL)
+                manager->thumb_index = create_thumbnail_index ();
+
+        /* The scanning and deleting happens on the housekeeping job pool,
+         * except on shutdown where there is no main loop left to wait for.
+         */
+        if (sync)
+                msd_thumbnail_index_purge_sync (manager->thumb_index, max_age, max_size);
+        else
+                msd_thumbnail_index_purge (manager->thumb_index, max_age, max_size);
 }
 
 static gboolean
 do_cleanup (MsdHousekeepingManager *manager)
 {
-        purge_thumbnail_cache (manager);
+        purge_thumbnail_cache (manager, FALSE);
         return TRUE;
 }
 
@@ -299,9 +214,15 @@ msd_housekeeping_manager_stop (MsdHousekeepingManager *manager)
                  */
                 if ((g_settings_get_int (manager->settings, THUMB_CACHE_KEY_AGE) == 0) ||
                     (g_settings_get_int (manager->settings, THUMB_CACHE_KEY_SIZE) == 0)) {
-                        do_cleanup (manager);
+                        purge_thumbnail_cache (manager, TRUE);
                 }
         }
+
+        if (manager->thumb_index != NULL) {
+                msd_thumbnail_index_save (manager->thumb_index);
+                msd_thumbnail_index_free (manager->thumb_index);
+                manager->thumb_index = NULL;
+        }
 }
 
 static void
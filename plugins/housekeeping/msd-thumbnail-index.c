@@ -0,0 +1,1152 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Persistent index of the thumbnail cache.
+ *
+ * Every thumbnail we know about is kept in a per-directory hash table
+ * (keyed by its file name, which already is the MD5 of the source URI)
+ * and in a binary min-heap ordered by modification time. The index is
+ * kept up to date from a GFileMonitor on each directory, so purging the
+ * cache only has to pop the oldest entries off the heap instead of
+ * enumerating and sorting the whole cache.
+ *
+ * The index is saved to disk together with the modification time of each
+ * directory. On load, a directory whose modification time differs from the
+ * saved one has been changed while we were not watching and is rescanned.
+ *
+ * Loading, listing and deleting files all happen on the housekeeping job
+ * pool; only the in-memory index is touched from the main loop.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "msd-housekeeping-jobs.h"
+#include "msd-thumbnail-index.h"
+
+#define INDEX_VERSION      1
+#define INDEX_VARIANT_TYPE "(ua(sxa(sxt)))"
+
+typedef struct _ThumbDir ThumbDir;
+
+typedef struct {
+        gchar    *name;
+        ThumbDir *dir;
+        gint64    mtime;
+        goffset   size;
+        guint     heap_pos;
+} ThumbEntry;
+
+struct _ThumbDir {
+        MsdThumbnailIndex *index;
+        guint              pos;
+        gchar             *path;
+        GFileMonitor      *monitor;
+        GHashTable        *entries;
+};
+
+/* Serializes the writes of the index file, and remembers the newest
+ * snapshot written, so that an older snapshot still being saved in a
+ * worker never replaces a newer one. Shared with the save jobs, which
+ * may outlive the index. */
+typedef struct {
+        gint     ref_count;
+        GMutex   lock;
+        guint64  written;       /* generation of the snapshot on disk */
+} ThumbWriter;
+
+typedef struct _ThumbSave ThumbSave;
+
+struct _MsdThumbnailIndex {
+        gchar              *index_file;
+        ThumbWriter        *writer;
+        guint64             generation;
+        MsdHousekeepingJob *save_job;
+        ThumbSave          *pending_save;       /* data of save_job */
+        GPtrArray          *dirs;
+        GPtrArray          *heap;
+        goffset             total_size;
+        gboolean            dirty;
+        gboolean            loaded;
+
+        MsdHousekeepingJob *job;
+        gboolean            purge_pending;
+        gboolean            scanned;
+        GTimeSpan           max_age;
+        goffset             max_size;
+};
+
+static gboolean
+is_thumbnail_name (const gchar *name)
+{
+        return strlen (name) == 36 && strcmp (name + 32, ".png") == 0;
+}
+
+static gint64
+get_mtime_for_path (const gchar *path)
+{
+        GStatBuf buf;
+
+        if (g_stat (path, &buf) != 0)
+                return 0;
+
+        return (gint64) buf.st_mtime;
+}
+
+/* Min-heap of ThumbEntry ordered by mtime; every entry knows its position
+ * so that it can be moved or removed in O(log n) when the monitor tells us
+ * it changed.
+ */
+
+#define HEAP_ENTRY(heap, pos) ((ThumbEntry *) g_ptr_array_index ((heap), (pos)))
+
+static void
+heap_swap (GPtrArray *heap,
+           guint      a,
+           guint      b)
+{
+        ThumbEntry *entry_a = HEAP_ENTRY (heap, a);
+        ThumbEntry *entry_b = HEAP_ENTRY (heap, b);
+
+        heap->pdata[a] = entry_b;
+        entry_b->heap_pos = a;
+        heap->pdata[b] = entry_a;
+        entry_a->heap_pos = b;
+}
+
+static void
+heap_sift_up (GPtrArray *heap,
+              guint      pos)
+{
+        while (pos > 0) {
+                guint parent = (pos - 1) / 2;
+
+                if (HEAP_ENTRY (heap, parent)->mtime <= HEAP_ENTRY (heap, pos)->mtime)
+                        break;
+
+                heap_swap (heap, parent, pos);
+                pos = parent;
+        }
+}
+
+static void
+heap_sift_down (GPtrArray *heap,
+                guint      pos)
+{
+        for (;;) {
+                guint left = 2 * pos + 1;
+                guint right = left + 1;
+                guint smallest = pos;
+
+                if (left < heap->len &&
+                    HEAP_ENTRY (heap, left)->mtime < HEAP_ENTRY (heap, smallest)->mtime)
+                        smallest = left;
+                if (right < heap->len &&
+                    HEAP_ENTRY (heap, right)->mtime < HEAP_ENTRY (heap, smallest)->mtime)
+                        smallest = right;
+
+                if (smallest == pos)
+                        break;
+
+                heap_swap (heap, pos, smallest);
+                pos = smallest;
+        }
+}
+
+static void
+heap_fix (GPtrArray *heap,
+          guint      pos)
+{
+        if (pos > 0 &&
+            HEAP_ENTRY (heap, (pos - 1) / 2)->mtime > HEAP_ENTRY (heap, pos)->mtime)
+                heap_sift_up (heap, pos);
+        else
+                heap_sift_down (heap, pos);
+}
+
+static void
+heap_push (GPtrArray  *heap,
+           ThumbEntry *entry)
+{
+        entry->heap_pos = heap->len;
+        g_ptr_array_add (heap, entry);
+        heap_sift_up (heap, entry->heap_pos);
+}
+
+static void
+heap_remove (GPtrArray  *heap,
+             ThumbEntry *entry)
+{
+        guint pos = entry->heap_pos;
+        guint last = heap->len - 1;
+
+        if (pos != last)
+                heap_swap (heap, pos, last);
+
+        g_ptr_array_remove_index (heap, last);
+
+        if (pos < heap->len)
+                heap_fix (heap, pos);
+}
+
+static void
+thumb_entry_free (gpointer data)
+{
+        ThumbEntry *entry = data;
+
+        g_free (entry->name);
+        g_free (entry);
+}
+
+static void
+thumb_index_set_entry (ThumbDir    *dir,
+                       const gchar *name,
+                       gint64       mtime,
+                       goffset      size)
+{
+        MsdThumbnailIndex *index = dir->index;
+        ThumbEntry        *entry;
+
+        entry = g_hash_table_lookup (dir->entries, name);
+        if (entry != NULL) {
+                if (entry->mtime == mtime && entry->size == size)
+                        return;
+
+                index->total_size -= entry->size;
+                entry->mtime = mtime;
+                entry->size = size;
+                heap_fix (index->heap, entry->heap_pos);
+        } else {
+                entry = g_new0 (ThumbEntry, 1);
+                entry->name = g_strdup (name);
+                entry->dir = dir;
+                entry->mtime = mtime;
+                entry->size = size;
+
+                g_hash_table_insert (dir->entries, entry->name, entry);
+                heap_push (index->heap, entry);
+        }
+
+        index->total_size += size;
+        index->dirty = TRUE;
+}
+
+static void
+thumb_index_remove_entry (ThumbEntry *entry)
+{
+        ThumbDir          *dir = entry->dir;
+        MsdThumbnailIndex *index = dir->index;
+
+        index->total_size -= entry->size;
+        index->dirty = TRUE;
+
+        heap_remove (index->heap, entry);
+        g_hash_table_remove (dir->entries, entry->name);
+}
+
+/* Re-reads a single file and updates (or drops) its entry accordingly */
+static void
+thumb_index_refresh_file (ThumbDir    *dir,
+                          const gchar *name)
+{
+        GStatBuf  buf;
+        gchar    *path;
+        gboolean  exists;
+
+        path = g_build_filename (dir->path, name, NULL);
+        exists = (g_stat (path, &buf) == 0);
+        g_free (path);
+
+        if (exists) {
+                thumb_index_set_entry (dir, name, (gint64) buf.st_mtime, (goffset) buf.st_size);
+        } else {
+                ThumbEntry *entry;
+
+                entry = g_hash_table_lookup (dir->entries, name);
+                if (entry != NULL)
+                        thumb_index_remove_entry (entry);
+        }
+}
+
+static void
+thumb_dir_clear (ThumbDir *dir)
+{
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_hash_table_iter_init (&iter, dir->entries);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                ThumbEntry *entry = value;
+
+                dir->index->total_size -= entry->size;
+                heap_remove (dir->index->heap, entry);
+                g_hash_table_iter_remove (&iter);
+        }
+        dir->index->dirty = TRUE;
+}
+
+static void
+thumb_dir_changed (GFileMonitor      *monitor G_GNUC_UNUSED,
+                   GFile             *file,
+                   GFile             *other_file G_GNUC_UNUSED,
+                   GFileMonitorEvent  event_type,
+                   ThumbDir          *dir)
+{
+        gchar *name;
+
+        switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+                break;
+        default:
+                return;
+        }
+
+        name = g_file_get_basename (file);
+        if (name != NULL && is_thumbnail_name (name))
+                thumb_index_refresh_file (dir, name);
+        g_free (name);
+}
+
+static ThumbDir *
+thumb_dir_new (MsdThumbnailIndex *index,
+               const gchar       *path)
+{
+        ThumbDir *dir;
+
+        dir = g_new0 (ThumbDir, 1);
+        dir->index = index;
+        dir->pos = index->dirs->len;
+        dir->path = g_strdup (path);
+        dir->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              NULL, thumb_entry_free);
+
+        return dir;
+}
+
+static void
+thumb_dir_start_monitor (ThumbDir *dir)
+{
+        GFile  *file;
+        GError *error = NULL;
+
+        file = g_file_new_for_path (dir->path);
+        dir->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+        g_object_unref (file);
+
+        if (dir->monitor == NULL) {
+                /* Without a monitor the directory is rescanned on every purge */
+                g_debug ("housekeeping: unable to monitor %s: %s", dir->path, error->message);
+                g_error_free (error);
+                return;
+        }
+
+        g_signal_connect (dir->monitor, "changed",
+                          G_CALLBACK (thumb_dir_changed), dir);
+}
+
+static void
+thumb_dir_free (gpointer data)
+{
+        ThumbDir *dir = data;
+
+        if (dir->monitor != NULL) {
+                g_signal_handlers_disconnect_by_func (dir->monitor, thumb_dir_changed, dir);
+                g_file_monitor_cancel (dir->monitor);
+                g_object_unref (dir->monitor);
+        }
+
+        g_hash_table_destroy (dir->entries);
+        g_free (dir->path);
+        g_free (dir);
+}
+
+static gboolean
+thumb_index_has_unmonitored_dirs (MsdThumbnailIndex *index)
+{
+        guint i;
+
+        for (i = 0; i < index->dirs->len; i++) {
+                ThumbDir *dir = g_ptr_array_index (index->dirs, i);
+
+                if (dir->monitor == NULL)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+static gchar **
+thumb_index_get_dir_paths (MsdThumbnailIndex *index)
+{
+        gchar **paths;
+        guint   i;
+
+        paths = g_new0 (gchar *, index->dirs->len + 1);
+        for (i = 0; i < index->dirs->len; i++) {
+                ThumbDir *dir = g_ptr_array_index (index->dirs, i);
+
+                paths[i] = g_strdup (dir->path);
+        }
+
+        return paths;
+}
+
+/* Plain copy of a cache entry, handed to and from the worker threads */
+typedef struct {
+        guint    dir;
+        gchar   *name;
+        gint64   mtime;
+        goffset  size;
+        gboolean gone;
+} ThumbFile;
+
+static ThumbFile *
+thumb_file_new (guint        dir,
+                const gchar *name,
+                gint64       mtime,
+                goffset      size)
+{
+        ThumbFile *file;
+
+        file = g_new0 (ThumbFile, 1);
+        file->dir = dir;
+        file->name = g_strdup (name);
+        file->mtime = mtime;
+        file->size = size;
+
+        return file;
+}
+
+static void
+thumb_file_free (gpointer data)
+{
+        ThumbFile *file = data;
+
+        g_free (file->name);
+        g_free (file);
+}
+
+/* Scanning: reads the saved index and lists the directories it can't vouch
+ * for. The result is merged into the index in the main loop.
+ */
+
+typedef struct {
+        MsdThumbnailIndex  *index;
+        gchar              *index_file;
+        gchar             **dir_paths;
+        gboolean           *wanted;
+        GPtrArray         **files;
+} ThumbScan;
+
+static ThumbScan *
+thumb_scan_new (MsdThumbnailIndex *index)
+{
+        ThumbScan *scan;
+        guint      i;
+
+        scan = g_new0 (ThumbScan, 1);
+        scan->index = index;
+        scan->dir_paths = thumb_index_get_dir_paths (index);
+        scan->wanted = g_new0 (gboolean, index->dirs->len);
+        scan->files = g_new0 (GPtrArray *, index->dirs->len);
+
+        /* Once loaded, only directories we can't watch need listing */
+        if (!index->loaded)
+                scan->index_file = g_strdup (index->index_file);
+
+        for (i = 0; i < index->dirs->len; i++) {
+                ThumbDir *dir = g_ptr_array_index (index->dirs, i);
+
+                scan->wanted[i] = !index->loaded || dir->monitor == NULL;
+        }
+
+        return scan;
+}
+
+static void
+thumb_scan_free (gpointer data)
+{
+        ThumbScan *scan = data;
+        guint      i;
+
+        for (i = 0; scan->dir_paths[i] != NULL; i++) {
+                if (scan->files[i] != NULL)
+                        g_ptr_array_free (scan->files[i], TRUE);
+        }
+
+        g_free (scan->files);
+        g_free (scan->wanted);
+        g_strfreev (scan->dir_paths);
+        g_free (scan->index_file);
+        g_free (scan);
+}
+
+static gint
+thumb_scan_find_dir (ThumbScan   *scan,
+                     const gchar *path)
+{
+        gint i;
+
+        for (i = 0; scan->dir_paths[i] != NULL; i++) {
+                if (g_strcmp0 (scan->dir_paths[i], path) == 0)
+                        return i;
+        }
+
+        return -1;
+}
+
+static void
+thumb_scan_read_index (ThumbScan    *scan,
+                       GCancellable *cancellable)
+{
+        gchar        *contents;
+        gsize         length;
+        GVariant     *variant;
+        GVariantIter *dirs_iter;
+        guint32       version;
+        const gchar  *path;
+        gint64        dir_mtime;
+        GVariantIter *entries_iter;
+
+        if (!g_file_get_contents (scan->index_file, &contents, &length, NULL))
+                return;
+
+        variant = g_variant_new_from_data (G_VARIANT_TYPE (INDEX_VARIANT_TYPE),
+                                           contents, length, FALSE,
+                                           g_free, contents);
+        g_variant_ref_sink (variant);
+
+        g_variant_get (variant, INDEX_VARIANT_TYPE, &version, &dirs_iter);
+        if (version != INDEX_VERSION) {
+                g_variant_iter_free (dirs_iter);
+                g_variant_unref (variant);
+                return;
+        }
+
+        while (g_variant_iter_loop (dirs_iter, "(&sxa(sxt))", &path, &dir_mtime, &entries_iter)) {
+                GPtrArray   *files;
+                const gchar *name;
+                gint64       mtime;
+                guint64      size;
+                gint         i;
+
+                if (g_cancellable_is_cancelled (cancellable))
+                        break;
+
+                /* A directory that changed while nobody watched it is listed again */
+                i = thumb_scan_find_dir (scan, path);
+                if (i < 0 || scan->files[i] != NULL || dir_mtime != get_mtime_for_path (path))
+                        continue;
+
+                files = g_ptr_array_new_with_free_func (thumb_file_free);
+                while (g_variant_iter_next (entries_iter, "(&sxt)", &name, &mtime, &size)) {
+                        if (is_thumbnail_name (name))
+                                g_ptr_array_add (files, thumb_file_new (i, name, mtime, (goffset) size));
+                }
+                scan->files[i] = files;
+        }
+
+        g_variant_iter_free (dirs_iter);
+        g_variant_unref (variant);
+}
+
+static GPtrArray *
+thumb_scan_list_dir (const gchar  *path,
+                     guint         dir,
+                     GCancellable *cancellable)
+{
+        GFile           *read_path;
+        GFileEnumerator *enum_dir;
+        GPtrArray       *files;
+
+        g_debug ("housekeeping: listing thumbnail directory %s", path);
+
+        files = g_ptr_array_new_with_free_func (thumb_file_free);
+
+        read_path = g_file_new_for_path (path);
+        enum_dir = g_file_enumerate_children (read_path,
+                                              G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                              G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                              G_FILE_QUERY_INFO_NONE,
+                                              cancellable,
+                                              NULL);
+
+        if (enum_dir != NULL) {
+                GFileInfo *info;
+                while ((info = g_file_enumerator_next_file (enum_dir, cancellable, NULL)) != NULL) {
+                        const char *name;
+                        name = g_file_info_get_name (info);
+
+                        if (is_thumbnail_name (name)) {
+                                g_ptr_array_add (files,
+                                                 thumb_file_new (dir, name,
+                                                                 (gint64) g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                                                                 g_file_info_get_size (info)));
+                        }
+                        g_object_unref (info);
+                }
+                g_object_unref (enum_dir);
+        }
+        g_object_unref (read_path);
+
+        return files;
+}
+
+/* Worker thread */
+static void
+thumb_scan_run (GCancellable *cancellable,
+                gpointer      data)
+{
+        ThumbScan *scan = data;
+        guint      i;
+
+        if (scan->index_file != NULL)
+                thumb_scan_read_index (scan, cancellable);
+
+        for (i = 0; scan->dir_paths[i] != NULL; i++) {
+                if (g_cancellable_is_cancelled (cancellable))
+                        return;
+
+                if (scan->wanted[i] && scan->files[i] == NULL)
+                        scan->files[i] = thumb_scan_list_dir (scan->dir_paths[i], i, cancellable);
+        }
+}
+
+static void
+thumb_scan_apply (ThumbScan *scan)
+{
+        MsdThumbnailIndex *index = scan->index;
+        guint              i, j;
+
+        for (i = 0; i < index->dirs->len; i++) {
+                ThumbDir *dir = g_ptr_array_index (index->dirs, i);
+
+                if (scan->files[i] == NULL)
+                        continue;
+
+                /* What the monitor reported in the meantime is more recent than
+                 * the listing, so only add files it hasn't told us about.
+                 */
+                if (dir->monitor == NULL)
+                        thumb_dir_clear (dir);
+
+                for (j = 0; j < scan->files[i]->len; j++) {
+                        ThumbFile *file = g_ptr_array_index (scan->files[i], j);
+
+                        if (!g_hash_table_contains (dir->entries, file->name))
+                                thumb_index_set_entry (dir, file->name, file->mtime, file->size);
+                }
+        }
+
+        index->loaded = TRUE;
+        index->scanned = TRUE;
+}
+
+/* Purging: the oldest entries are picked in the main loop, then verified
+ * and deleted by a worker. Entries stay in the index until the worker is
+ * done, so that a cancelled purge leaves the index consistent.
+ */
+
+typedef struct {
+        MsdThumbnailIndex  *index;
+        gchar             **dir_paths;
+        GPtrArray          *files;
+        guint               purged;
+} ThumbPurge;
+
+static ThumbPurge *
+thumb_purge_new (MsdThumbnailIndex *index,
+                 GTimeSpan          max_age,
+                 goffset            max_size)
+{
+        ThumbPurge *purge;
+        GPtrArray  *popped;
+        goffset     total_size;
+        gint64      now;
+        guint       i;
+
+        purge = g_new0 (ThumbPurge, 1);
+        purge->index = index;
+        purge->dir_paths = thumb_index_get_dir_paths (index);
+        purge->files = g_ptr_array_new_with_free_func (thumb_file_free);
+
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        total_size = index->total_size;
+        popped = g_ptr_array_new ();
+
+        while (index->heap->len > 0) {
+                ThumbEntry *oldest = HEAP_ENTRY (index->heap, 0);
+
+                if (!(max_age >= 0 && (now - oldest->mtime) * G_TIME_SPAN_SECOND > max_age) &&
+                    !(max_size >= 0 && total_size > max_size))
+                        break;
+
+                total_size -= oldest->size;
+                heap_remove (index->heap, oldest);
+                g_ptr_array_add (popped, oldest);
+                g_ptr_array_add (purge->files,
+                                 thumb_file_new (oldest->dir->pos, oldest->name,
+                                                 oldest->mtime, oldest->size));
+        }
+
+        for (i = 0; i < popped->len; i++)
+                heap_push (index->heap, g_ptr_array_index (popped, i));
+        g_ptr_array_free (popped, TRUE);
+
+        return purge;
+}
+
+static void
+thumb_purge_free (gpointer data)
+{
+        ThumbPurge *purge = data;
+
+        g_ptr_array_free (purge->files, TRUE);
+        g_strfreev (purge->dir_paths);
+        g_free (purge);
+}
+
+/* Worker thread */
+static void
+thumb_purge_run (GCancellable *cancellable,
+                 gpointer      data)
+{
+        ThumbPurge *purge = data;
+        guint       i;
+
+        for (i = 0; i < purge->files->len; i++) {
+                ThumbFile *file = g_ptr_array_index (purge->files, i);
+                GStatBuf   buf;
+                gchar     *path;
+
+                if (g_cancellable_is_cancelled (cancellable))
+                        return;
+
+                path = g_build_filename (purge->dir_paths[file->dir], file->name, NULL);
+
+                /* Don't delete a thumbnail that was refreshed behind our back */
+                if (g_stat (path, &buf) != 0) {
+                        file->gone = TRUE;
+                } else if ((gint64) buf.st_mtime != file->mtime ||
+                           (goffset) buf.st_size != file->size) {
+                        file->mtime = (gint64) buf.st_mtime;
+                        file->size = (goffset) buf.st_size;
+                } else {
+                        g_unlink (path);
+                        file->gone = TRUE;
+                        purge->purged++;
+                }
+
+                g_free (path);
+        }
+}
+
+static void
+thumb_purge_apply (ThumbPurge *purge)
+{
+        MsdThumbnailIndex *index = purge->index;
+        guint              i;
+
+        for (i = 0; i < purge->files->len; i++) {
+                ThumbFile *file = g_ptr_array_index (purge->files, i);
+                ThumbDir  *dir = g_ptr_array_index (index->dirs, file->dir);
+                ThumbEntry *entry;
+
+                if (!file->gone) {
+                        thumb_index_set_entry (dir, file->name, file->mtime, file->size);
+                        continue;
+                }
+
+                /* The file may have been recreated since it was deleted */
+                entry = g_hash_table_lookup (dir->entries, file->name);
+                if (entry != NULL && entry->mtime == file->mtime)
+                        thumb_index_remove_entry (entry);
+        }
+
+        g_debug ("housekeeping: purged %u thumbnails, %u left (%" G_GOFFSET_FORMAT " bytes)",
+                 purge->purged, index->heap->len, index->total_size);
+}
+
+/* Saving */
+
+static GVariant *
+thumb_index_serialize (MsdThumbnailIndex *index)
+{
+        GVariantBuilder builder;
+        guint           i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxa(sxt))"));
+
+        for (i = 0; i < index->dirs->len; i++) {
+                ThumbDir       *dir = g_ptr_array_index (index->dirs, i);
+                GHashTableIter  iter;
+                gpointer        value;
+
+                /* A directory we cannot watch can't be trusted on the next load */
+                if (dir->monitor == NULL)
+                        continue;
+
+                g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sxa(sxt))"));
+                g_variant_builder_add (&builder, "s", dir->path);
+                g_variant_builder_add (&builder, "x", get_mtime_for_path (dir->path));
+                g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(sxt)"));
+
+                g_hash_table_iter_init (&iter, dir->entries);
+                while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                        ThumbEntry *entry = value;
+
+                        g_variant_builder_add (&builder, "(sxt)",
+                                               entry->name, entry->mtime, (guint64) entry->size);
+                }
+
+                g_variant_builder_close (&builder);
+                g_variant_builder_close (&builder);
+        }
+
+        return g_variant_ref_sink (g_variant_new (INDEX_VARIANT_TYPE, INDEX_VERSION, &builder));
+}
+
+static gboolean
+thumb_index_write (const gchar *index_file,
+                   GVariant    *variant)
+{
+        gchar    *dirname;
+        GError   *error = NULL;
+
+        dirname = g_path_get_dirname (index_file);
+        g_mkdir_with_parents (dirname, 0700);
+        g_free (dirname);
+
+        if (!g_file_set_contents (index_file,
+                                  g_variant_get_data (variant),
+                                  g_variant_get_size (variant),
+                                  &error)) {
+                g_warning ("Unable to save the thumbnail cache index: %s", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static ThumbWriter *
+thumb_writer_new (void)
+{
+        ThumbWriter *writer = g_new0 (ThumbWriter, 1);
+
+        writer->ref_count = 1;
+        g_mutex_init (&writer->lock);
+
+        return writer;
+}
+
+static ThumbWriter *
+thumb_writer_ref (ThumbWriter *writer)
+{
+        g_atomic_int_inc (&writer->ref_count);
+        return writer;
+}
+
+static void
+thumb_writer_unref (ThumbWriter *writer)
+{
+        if (!g_atomic_int_dec_and_test (&writer->ref_count))
+                return;
+
+        g_mutex_clear (&writer->lock);
+        g_free (writer);
+}
+
+/* Writes snapshot @generation unless a newer one is already on disk */
+static gboolean
+thumb_writer_write (ThumbWriter *writer,
+                    guint64      generation,
+                    const gchar *index_file,
+                    GVariant    *variant)
+{
+        gboolean retval = TRUE;
+
+        g_mutex_lock (&writer->lock);
+        if (generation > writer->written) {
+                retval = thumb_index_write (index_file, variant);
+                if (retval)
+                        writer->written = generation;
+        }
+        g_mutex_unlock (&writer->lock);
+
+        return retval;
+}
+
+struct _ThumbSave {
+        MsdThumbnailIndex *index;       /* NULL once the index is freed */
+        ThumbWriter       *writer;
+        guint64            generation;
+        gchar             *index_file;
+        GVariant          *variant;
+};
+
+static void
+thumb_save_free (gpointer data)
+{
+        ThumbSave *save = data;
+
+        thumb_writer_unref (save->writer);
+        g_variant_unref (save->variant);
+        g_free (save->index_file);
+        g_free (save);
+}
+
+/* Worker thread */
+static void
+thumb_save_run (GCancellable *cancellable G_GNUC_UNUSED,
+                gpointer      data)
+{
+        ThumbSave *save = data;
+
+        thumb_writer_write (save->writer, save->generation, save->index_file, save->variant);
+}
+
+static void
+thumb_save_done (gboolean completed G_GNUC_UNUSED,
+                 gpointer data)
+{
+        ThumbSave *save = data;
+
+        if (save->index != NULL) {
+                save->index->save_job = NULL;
+                save->index->pending_save = NULL;
+        }
+}
+
+static void
+thumb_index_save_async (MsdThumbnailIndex *index)
+{
+        ThumbSave *save;
+
+        if (!index->loaded || !index->dirty)
+                return;
+
+        /* the new snapshot supersedes one that has not been written yet */
+        if (index->save_job != NULL)
+                msd_housekeeping_job_cancel (index->save_job);
+
+        save = g_new0 (ThumbSave, 1);
+        save->index = index;
+        save->writer = thumb_writer_ref (index->writer);
+        save->generation = ++index->generation;
+        save->index_file = g_strdup (index->index_file);
+        save->variant = thumb_index_serialize (index);
+        index->dirty = FALSE;
+
+        index->pending_save = save;
+        index->save_job = msd_housekeeping_job_run (thumb_save_run, thumb_save_done,
+                                                    save, thumb_save_free, 0);
+}
+
+gboolean
+msd_thumbnail_index_save (MsdThumbnailIndex *index)
+{
+        GVariant *variant;
+        gboolean  retval;
+
+        g_return_val_if_fail (index != NULL, FALSE);
+
+        if (!index->loaded)
+                return FALSE;
+
+        if (!index->dirty)
+                return TRUE;
+
+        variant = thumb_index_serialize (index);
+        retval = thumb_writer_write (index->writer, ++index->generation,
+                                     index->index_file, variant);
+        if (retval)
+                index->dirty = FALSE;
+        g_variant_unref (variant);
+
+        return retval;
+}
+
+/* Running the jobs */
+
+static void thumb_index_continue (MsdThumbnailIndex *index);
+
+static void
+thumb_scan_done (gboolean completed G_GNUC_UNUSED,
+                 gpointer data)
+{
+        ThumbScan         *scan = data;
+        MsdThumbnailIndex *index = scan->index;
+
+        index->job = NULL;
+        thumb_scan_apply (scan);
+        thumb_index_continue (index);
+}
+
+static void
+thumb_purge_done (gboolean completed G_GNUC_UNUSED,
+                  gpointer data)
+{
+        ThumbPurge        *purge = data;
+        MsdThumbnailIndex *index = purge->index;
+
+        index->job = NULL;
+        thumb_purge_apply (purge);
+        thumb_index_save_async (index);
+        thumb_index_continue (index);
+}
+
+static void
+thumb_index_continue (MsdThumbnailIndex *index)
+{
+        if (index->job != NULL || !index->purge_pending)
+                return;
+
+        if (!index->loaded || (!index->scanned && thumb_index_has_unmonitored_dirs (index))) {
+                index->job = msd_housekeeping_job_run (thumb_scan_run, thumb_scan_done,
+                                                       thumb_scan_new (index), thumb_scan_free, 0);
+                return;
+        }
+
+        index->purge_pending = FALSE;
+        index->job = msd_housekeeping_job_run (thumb_purge_run, thumb_purge_done,
+                                               thumb_purge_new (index, index->max_age, index->max_size),
+                                               thumb_purge_free, 0);
+}
+
+MsdThumbnailIndex *
+msd_thumbnail_index_new (const gchar         *index_file,
+                         const gchar * const *dirs)
+{
+        MsdThumbnailIndex *index;
+        guint              i;
+
+        g_return_val_if_fail (index_file != NULL, NULL);
+        g_return_val_if_fail (dirs != NULL, NULL);
+
+        index = g_new0 (MsdThumbnailIndex, 1);
+        index->index_file = g_strdup (index_file);
+        index->writer = thumb_writer_new ();
+        index->dirs = g_ptr_array_new_with_free_func (thumb_dir_free);
+        index->heap = g_ptr_array_new ();
+
+        /* Start watching right away, so that no change can slip between
+         * loading or listing a directory and monitoring it. The index itself
+         * is loaded by the first purge.
+         */
+        for (i = 0; dirs[i] != NULL; i++) {
+                ThumbDir *dir = thumb_dir_new (index, dirs[i]);
+
+                g_ptr_array_add (index->dirs, dir);
+                thumb_dir_start_monitor (dir);
+        }
+
+        return index;
+}
+
+void
+msd_thumbnail_index_free (MsdThumbnailIndex *index)
+{
+        if (index == NULL)
+                return;
+
+        if (index->job != NULL)
+                msd_housekeeping_job_cancel (index->job);
+
+        /* A pending save still writes its snapshot, unless
+         * msd_thumbnail_index_save() has written a newer one */
+        if (index->pending_save != NULL)
+                index->pending_save->index = NULL;
+        thumb_writer_unref (index->writer);
+
+        /* Free the directories last, the entries are owned by them */
+        g_ptr_array_free (index->heap, TRUE);
+        g_ptr_array_free (index->dirs, TRUE);
+        g_free (index->index_file);
+        g_free (index);
+}
+
+/**
+ * msd_thumbnail_index_purge:
+ *
+ * Deletes the thumbnails older than @max_age and then the oldest ones
+ * until the cache is no bigger than @max_size. A negative value disables
+ * the respective limit. The work is done in a worker thread.
+ */
+void
+msd_thumbnail_index_purge (MsdThumbnailIndex *index,
+                           GTimeSpan          max_age,
+                           goffset            max_size)
+{
+        g_return_if_fail (index != NULL);
+
+        index->max_age = max_age;
+        index->max_size = max_size;
+        index->purge_pending = TRUE;
+        index->scanned = FALSE;
+
+        thumb_index_continue (index);
+}
+
+/**
+ * msd_thumbnail_index_purge_sync:
+ *
+ * Same as msd_thumbnail_index_purge(), but blocks until the cache has
+ * been purged. Only meant to be used on shutdown.
+ */
+void
+msd_thumbnail_index_purge_sync (MsdThumbnailIndex *index,
+                                GTimeSpan          max_age,
+                                goffset            max_size)
+{
+        ThumbPurge *purge;
+
+        g_return_if_fail (index != NULL);
+
+        if (index->job != NULL) {
+                msd_housekeeping_job_cancel (index->job);
+                index->job = NULL;
+        }
+        index->purge_pending = FALSE;
+
+        if (!index->loaded || thumb_index_has_unmonitored_dirs (index)) {
+                ThumbScan *scan;
+
+                scan = thumb_scan_new (index);
+                thumb_scan_run (NULL, scan);
+                thumb_scan_apply (scan);
+                thumb_scan_free (scan);
+        }
+
+        purge = thumb_purge_new (index, max_age, max_size);
+        thumb_purge_run (NULL, purge);
+        thumb_purge_apply (purge);
+        thumb_purge_free (purge);
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __MSD_THUMBNAIL_INDEX_H
+#define __MSD_THUMBNAIL_INDEX_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _MsdThumbnailIndex MsdThumbnailIndex;
+
+MsdThumbnailIndex *msd_thumbnail_index_new        (const gchar         *index_file,
+                                                   const gchar * const *dirs);
+void               msd_thumbnail_index_free       (MsdThumbnailIndex   *index);
+void               msd_thumbnail_index_purge      (MsdThumbnailIndex   *index,
+                                                   GTimeSpan            max_age,
+                                                   goffset              max_size);
+void               msd_thumbnail_index_purge_sync (MsdThumbnailIndex   *index,
+                                                   GTimeSpan            max_age,
+                                                   goffset              max_size);
+gboolean           msd_thumbnail_index_save       (MsdThumbnailIndex   *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MSD_THUMBNAIL_INDEX_H */
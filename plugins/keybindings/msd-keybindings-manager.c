@@ -47,6 +47,7 @@
 #include "dconf-util.h"
 
 #include "msd-keygrab.h"
+#include "msd-spawn.h"
 #include "eggaccelerators.h"
 
 #define GSETTINGS_KEYBINDINGS_DIR "/org/mate/desktop/keybindings/"
@@ -56,15 +57,19 @@ typedef struct {
         char *binding_str;
         char *action;
         char *settings_path;
+        char **argv;    /* action, parsed once when the binding is loaded */
         Key   key;
-        Key   previous_key;
+        guint seq;      /* creation order, earlier bindings win conflicts */
 } Binding;
 
 struct MsdKeybindingsManagerPrivate
 {
         DConfClient *client;
-        GSList      *binding_list;
+        GHashTable  *bindings;  /* settings path -> Binding */
+        guint        next_seq;
         GSList      *screens;
+        MsdKeyTable *key_table;
+        MsdGrabSet  *grab_set;
 };
 
 static void     msd_keybindings_manager_finalize    (GObject *object);
@@ -113,23 +118,26 @@ parse_binding (Binding *binding)
         return success;
 }
 
-static gint
-compare_bindings (gconstpointer a,
-                  gconstpointer b)
+static void
+binding_free (Binding *binding)
 {
-        Binding *key_a = (Binding *) a;
-        char    *key_b = (char *) b;
-
-        return g_strcmp0 (key_b, key_a->settings_path);
+        g_free (binding->binding_str);
+        g_free (binding->action);
+        g_free (binding->settings_path);
+        g_strfreev (binding->argv);
+        g_free (binding->key.keycodes);
+        g_free (binding);
 }
 
+/* (Re)reads the binding stored at @settings_path; a binding that was
+ * removed or became invalid is dropped */
 static gboolean
 bindings_get_entry (MsdKeybindingsManager *manager,
                     const char            *settings_path)
 {
         GSettings *settings;
-        Binding   *new_binding;
-        GSList    *tmp_elem;
+        Binding   *binding;
+        gboolean   is_new;
         char      *action = NULL;
         char      *key = NULL;
 
@@ -147,71 +155,44 @@ bindings_get_entry (MsdKeybindingsManager *manager,
                 g_warning (_("Key binding (%s) is incomplete"), settings_path);
                 g_free (action);
                 g_free (key);
+                g_hash_table_remove (manager->priv->bindings, settings_path);
                 return FALSE;
         }
 
         g_debug ("keybindings: get entries from '%s' (action: '%s', key: '%s')", settings_path, action, key);
 
-        tmp_elem = g_slist_find_custom (manager->priv->binding_list,
-                                        settings_path,
-                                        compare_bindings);
-
-        if (!tmp_elem) {
-                new_binding = g_new0 (Binding, 1);
+        binding = g_hash_table_lookup (manager->priv->bindings, settings_path);
+        is_new = (binding == NULL);
+        if (is_new) {
+                binding = g_new0 (Binding, 1);
+                binding->settings_path = g_strdup (settings_path);
+                binding->seq = manager->priv->next_seq++;
         } else {
-                new_binding = (Binding *) tmp_elem->data;
-                g_free (new_binding->binding_str);
-                g_free (new_binding->action);
-                g_free (new_binding->settings_path);
-
-                new_binding->previous_key.keysym = new_binding->key.keysym;
-                new_binding->previous_key.state = new_binding->key.state;
-                new_binding->previous_key.keycodes = new_binding->key.keycodes;
-                new_binding->key.keycodes = NULL;
+                g_free (binding->binding_str);
+                g_free (binding->action);
+                g_clear_pointer (&binding->argv, g_strfreev);
         }
 
-        new_binding->binding_str = key;
-        new_binding->action = action;
-        new_binding->settings_path = g_strdup (settings_path);
+        binding->binding_str = key;
+        binding->action = action;
 
-        if (parse_binding (new_binding)) {
-                if (!tmp_elem)
-                        manager->priv->binding_list = g_slist_prepend (manager->priv->binding_list, new_binding);
-        } else {
-                g_free (new_binding->binding_str);
-                g_free (new_binding->action);
-                g_free (new_binding->settings_path);
-                g_free (new_binding->previous_key.keycodes);
-                g_free (new_binding);
-
-                if (tmp_elem)
-                        manager->priv->binding_list = g_slist_delete_link (manager->priv->binding_list, tmp_elem);
+        /* an action that cannot be parsed is ignored when the key is pressed */
+        if (!g_shell_parse_argv (binding->action, NULL, &binding->argv, NULL))
+                g_debug ("keybindings: cannot parse action '%s' of '%s'", binding->action, settings_path);
+
+        if (!parse_binding (binding)) {
+                if (is_new)
+                        binding_free (binding);
+                else
+                        g_hash_table_remove (manager->priv->bindings, settings_path);
                 return FALSE;
         }
 
-        return TRUE;
-}
-
-static void
-bindings_clear (MsdKeybindingsManager *manager)
-{
-        MsdKeybindingsManagerPrivate *p = manager->priv;
-        GSList *l;
+        /* an existing binding was updated in place and stays in the table */
+        if (is_new)
+                g_hash_table_insert (manager->priv->bindings, binding->settings_path, binding);
 
-        if (p->binding_list != NULL)
-        {
-                for (l = p->binding_list; l; l = l->next) {
-                        Binding *b = l->data;
-                        g_free (b->binding_str);
-                        g_free (b->action);
-                        g_free (b->settings_path);
-                        g_free (b->previous_key.keycodes);
-                        g_free (b->key.keycodes);
-                        g_free (b);
-                }
-                g_slist_free (p->binding_list);
-                p->binding_list = NULL;
-        }
+        return TRUE;
 }
 
 static void
@@ -220,7 +201,7 @@ bindings_get_entries (MsdKeybindingsManager *manager)
         gchar **custom_list = NULL;
         gint i;
 
-        bindings_clear (manager);
+        g_hash_table_remove_all (manager->priv->bindings);
 
         custom_list = dconf_util_list_subdirs (GSETTINGS_KEYBINDINGS_DIR, FALSE);
 
@@ -235,134 +216,66 @@ bindings_get_entries (MsdKeybindingsManager *manager)
                 }
                 g_strfreev (custom_list);
         }
-
 }
 
-static gboolean
-same_keycode (const Key *key, const Key *other)
+static gint
+compare_bindings (gconstpointer a,
+                  gconstpointer b)
 {
-        if (key->keycodes != NULL && other->keycodes != NULL) {
-                guint *c;
+        const Binding *binding_a = *(const Binding **) a;
+        const Binding *binding_b = *(const Binding **) b;
 
-                for (c = key->keycodes; *c; ++c) {
-                        if (key_uses_keycode (other, *c))
-                                return TRUE;
-                }
-        }
-        return FALSE;
+        return (binding_a->seq > binding_b->seq) - (binding_a->seq < binding_b->seq);
 }
 
-static gboolean
-same_key (const Key *key, const Key *other)
-{
-        if (key->state == other->state) {
-                if (key->keycodes != NULL && other->keycodes != NULL) {
-                        guint *c1, *c2;
-
-                        for (c1 = key->keycodes, c2 = other->keycodes;
-                             *c1 || *c2; ++c1, ++c2) {
-                                     if (*c1 != *c2)
-                                        return FALSE;
-                        }
-                } else if (key->keycodes != NULL || other->keycodes != NULL)
-                        return FALSE;
-
-                return TRUE;
-        }
-
-        return FALSE;
-}
-
-static gboolean
-key_already_used (MsdKeybindingsManager *manager,
-                  Binding               *binding)
+static void
+binding_grab_failed (Key                   *key,
+                     MsdGrabFailure         reason,
+                     Binding               *binding,
+                     MsdKeybindingsManager *manager)
 {
-        GSList *li;
-
-        for (li = manager->priv->binding_list; li != NULL; li = li->next) {
-                Binding *tmp_binding =  (Binding*) li->data;
-
-                if (tmp_binding != binding &&
-                    same_keycode (&tmp_binding->key, &binding->key) &&
-                    tmp_binding->key.state == binding->key.state) {
-                        return TRUE;
-                }
-        }
-
-        return FALSE;
+        if (reason == MSD_GRAB_CONFLICT)
+                g_warning ("Key binding (%s) is already in use", binding->binding_str);
+        else
+                g_warning ("Grab failed for key binding (%s), another application may already have access to it",
+                           binding->binding_str);
 }
 
+/* Must be called whenever a binding was added, changed or removed:
+ * refreshes the dispatch table and grabs the keys, only touching the
+ * grabs that changed */
 static void
-binding_unregister_keys (MsdKeybindingsManager *manager)
+bindings_apply (MsdKeybindingsManager *manager)
 {
-        GdkDisplay *dpy;
-        GSList *li;
-        gboolean need_flush = FALSE;
+        GHashTableIter  iter;
+        GPtrArray      *sorted;
+        gpointer        binding;
+        guint           i;
 
-        dpy = gdk_display_get_default ();
-        gdk_x11_display_error_trap_push (dpy);
-
-        for (li = manager->priv->binding_list; li != NULL; li = li->next) {
-                Binding *binding = (Binding *) li->data;
-
-                if (binding->key.keycodes) {
-                        need_flush = TRUE;
-                        grab_key_unsafe (&binding->key, FALSE, manager->priv->screens);
-                }
-        }
+        sorted = g_ptr_array_sized_new (g_hash_table_size (manager->priv->bindings));
+        g_hash_table_iter_init (&iter, manager->priv->bindings);
+        while (g_hash_table_iter_next (&iter, NULL, &binding))
+                g_ptr_array_add (sorted, binding);
+        g_ptr_array_sort (sorted, compare_bindings);
 
-        if (need_flush)
-                gdk_display_flush (dpy);
-
-        gdk_x11_display_error_trap_pop_ignored (dpy);
-}
-
-static void
-binding_register_keys (MsdKeybindingsManager *manager)
-{
-        GSList *li;
-        GdkDisplay *dpy;
-        gboolean need_flush = FALSE;
+        msd_key_table_remove_all (manager->priv->key_table);
+        msd_grab_set_begin (manager->priv->grab_set);
 
-        dpy = gdk_display_get_default ();
-        gdk_x11_display_error_trap_push (dpy);
+        for (i = 0; i < sorted->len; i++) {
+                Binding *b = g_ptr_array_index (sorted, i);
 
-        /* Now check for changes and grab new key if not already used */
-        for (li = manager->priv->binding_list; li != NULL; li = li->next) {
-                Binding *binding = (Binding *) li->data;
-
-                if (!same_key (&binding->previous_key, &binding->key)) {
-                        /* Ungrab key if it changed and not clashing with previously set binding */
-                        if (!key_already_used (manager, binding)) {
-                                gint i;
-
-                                need_flush = TRUE;
-                                if (binding->previous_key.keycodes) {
-                                        grab_key_unsafe (&binding->previous_key, FALSE, manager->priv->screens);
-                                }
-                                grab_key_unsafe (&binding->key, TRUE, manager->priv->screens);
-
-                                binding->previous_key.keysym = binding->key.keysym;
-                                binding->previous_key.state = binding->key.state;
-                                g_free (binding->previous_key.keycodes);
-                                for (i = 0; binding->key.keycodes[i]; ++i);
-                                binding->previous_key.keycodes = g_new0 (guint, i);
-                                for (i = 0; binding->key.keycodes[i]; ++i)
-                                        binding->previous_key.keycodes[i] = binding->key.keycodes[i];
-                        } else
-                                g_warning ("Key binding (%s) is already in use", binding->binding_str);
-                }
+                msd_key_table_add (manager->priv->key_table, &b->key, b);
+                msd_grab_set_add (manager->priv->grab_set, &b->key, b);
         }
 
-        if (need_flush)
-                gdk_display_flush (dpy);
-        if (gdk_x11_display_error_trap_pop (dpy))
-                g_warning ("Grab failed for some keys, another application may already have access the them.");
+        msd_grab_set_commit (manager->priv->grab_set,
+                             manager->priv->screens,
+                             (MsdGrabFailedFunc) binding_grab_failed,
+                             manager);
 
+        g_ptr_array_free (sorted, TRUE);
 }
 
-extern char **environ;
-
 static char *
 screen_exec_display_string (GdkScreen *screen)
 {
@@ -394,8 +307,9 @@ screen_exec_display_string (GdkScreen *screen)
  * ensure that $DISPLAY is set such that a launched application
  * inheriting this environment would appear on screen.
  *
- * Returns: a newly-allocated %NULL-terminated array of strings or
- * %NULL on error. Use g_strfreev() to free it.
+ * Returns: a newly-allocated %NULL-terminated array of strings,
+ * or %NULL if the current environment can be used as is or on
+ * error. Use g_strfreev() to free it.
  *
  * mainly ripped from egg_screen_exec_display_string in
  * mate-panel/egg-screen-exec.c
@@ -403,11 +317,11 @@ screen_exec_display_string (GdkScreen *screen)
 static char **
 get_exec_environment (XEvent *xevent)
 {
-        char     **retval = NULL;
-        int        i;
-        int        display_index = -1;
-        GdkScreen *screen = NULL;
-        GdkWindow *window = gdk_x11_window_lookup_for_display (gdk_display_get_default (), xevent->xkey.root);
+        char      **retval = NULL;
+        char       *display;
+        const char *old_display;
+        GdkScreen  *screen = NULL;
+        GdkWindow  *window = gdk_x11_window_lookup_for_display (gdk_display_get_default (), xevent->xkey.root);
 
         if (window) {
                 screen = gdk_window_get_screen (window);
@@ -415,27 +329,18 @@ get_exec_environment (XEvent *xevent)
 
         g_return_val_if_fail (GDK_IS_SCREEN (screen), NULL);
 
-        for (i = 0; environ [i]; i++) {
-                if (!strncmp (environ [i], "DISPLAY", 7)) {
-                        display_index = i;
-                }
-        }
+        display = screen_exec_display_string (screen);
 
-        if (display_index == -1) {
-                display_index = i++;
+        /* the usual case: $DISPLAY already points to the screen */
+        old_display = g_getenv ("DISPLAY");
+        if (old_display != NULL && strcmp (old_display, display + strlen ("DISPLAY=")) == 0) {
+                g_free (display);
+                return NULL;
         }
 
-        retval = g_new (char *, i + 1);
-
-        for (i = 0; environ [i]; i++) {
-                if (i == display_index) {
-                        retval [i] = screen_exec_display_string (screen);
-                } else {
-                        retval [i] = g_strdup (environ [i]);
-                }
-        }
-
-        retval [i] = NULL;
+        retval = g_get_environ ();
+        retval = g_environ_setenv (retval, "DISPLAY", display + strlen ("DISPLAY="), TRUE);
+        g_free (display);
 
         return retval;
 }
@@ -445,76 +350,105 @@ keybindings_filter (GdkXEvent             *gdk_xevent,
                     GdkEvent              *event,
                     MsdKeybindingsManager *manager)
 {
-        XEvent *xevent = (XEvent *) gdk_xevent;
-        GSList *li;
+        XEvent   *xevent = (XEvent *) gdk_xevent;
+        Binding  *binding;
+        GError   *error = NULL;
+        gboolean  retval;
+        gchar   **envp = NULL;
 
         if (xevent->type != KeyPress) {
                 return GDK_FILTER_CONTINUE;
         }
 
-        for (li = manager->priv->binding_list; li != NULL; li = li->next) {
-                Binding *binding = (Binding *) li->data;
-
-                if (match_key (&binding->key, xevent)) {
-                        GError  *error = NULL;
-                        gboolean retval;
-                        gchar  **argv = NULL;
-                        gchar  **envp = NULL;
-
-                        g_return_val_if_fail (binding->action != NULL, GDK_FILTER_CONTINUE);
-
-                        if (!g_shell_parse_argv (binding->action,
-                                                 NULL, &argv,
-                                                 &error)) {
-                                return GDK_FILTER_CONTINUE;
-                        }
-
-                        envp = get_exec_environment (xevent);
-
-                        retval = g_spawn_async (NULL,
-                                                argv,
-                                                envp,
-                                                G_SPAWN_SEARCH_PATH,
-                                                NULL,
-                                                NULL,
-                                                NULL,
-                                                &error);
-                        g_strfreev (argv);
-                        g_strfreev (envp);
-
-                        if (!retval) {
-                                GtkWidget *dialog = gtk_message_dialog_new (NULL, 0, GTK_MESSAGE_WARNING,
-                                                                            GTK_BUTTONS_CLOSE,
-                                                                            _("Error while trying to run (%s)\n"\
-                                                                              "which is linked to the key (%s)"),
-                                                                            binding->action,
-                                                                            binding->binding_str);
-                                g_signal_connect (dialog,
-                                                  "response",
-                                                  G_CALLBACK (gtk_widget_destroy),
-                                                  NULL);
-                                gtk_widget_show (dialog);
-                        }
-                        return GDK_FILTER_REMOVE;
-                }
+        binding = msd_key_table_lookup (manager->priv->key_table, xevent);
+        if (binding == NULL) {
+                return GDK_FILTER_CONTINUE;
         }
-        return GDK_FILTER_CONTINUE;
+
+        g_return_val_if_fail (binding->action != NULL, GDK_FILTER_CONTINUE);
+
+        if (binding->argv == NULL) {
+                return GDK_FILTER_CONTINUE;
+        }
+
+        envp = get_exec_environment (xevent);
+
+        retval = msd_spawn_async (NULL, binding->argv, envp, &error);
+        g_strfreev (envp);
+
+        if (!retval) {
+                GtkWidget *dialog = gtk_message_dialog_new (NULL, 0, GTK_MESSAGE_WARNING,
+                                                            GTK_BUTTONS_CLOSE,
+                                                            _("Error while trying to run (%s)\n"\
+                                                              "which is linked to the key (%s)"),
+                                                            binding->action,
+                                                            binding->binding_str);
+                g_signal_connect (dialog,
+                                  "response",
+                                  G_CALLBACK (gtk_widget_destroy),
+                                  NULL);
+                gtk_widget_show (dialog);
+                g_clear_error (&error);
+        }
+
+        return GDK_FILTER_REMOVE;
 }
 
 static void
 bindings_callback (DConfClient           *client G_GNUC_UNUSED,
-                   gchar                 *prefix G_GNUC_UNUSED,
-                   GStrv                  changes G_GNUC_UNUSED,
+                   gchar                 *prefix,
+                   GStrv                  changes,
                    gchar                 *tag G_GNUC_UNUSED,
                    MsdKeybindingsManager *manager)
 {
+        GHashTable     *paths;
+        gboolean        reload_all = FALSE;
+        gint            i;
+
         g_debug ("keybindings: received 'changed' signal from dconf");
 
-        binding_unregister_keys (manager);
+        /* collect the binding directories the changes fall into */
+        paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        for (i = 0; changes[i] != NULL && !reload_all; i++) {
+                gchar       *path = g_strconcat (prefix, changes[i], NULL);
+                const gchar *rel;
+                const gchar *slash;
+
+                if (g_str_has_prefix (GSETTINGS_KEYBINDINGS_DIR, path)) {
+                        /* the whole directory, or one of its parents */
+                        reload_all = TRUE;
+                } else if (g_str_has_prefix (path, GSETTINGS_KEYBINDINGS_DIR)) {
+                        rel = path + strlen (GSETTINGS_KEYBINDINGS_DIR);
+                        slash = strchr (rel, '/');
+                        if (slash != NULL)
+                                g_hash_table_add (paths, g_strndup (path, slash + 1 - path));
+                }
 
-        bindings_get_entries (manager);
+                g_free (path);
+        }
+
+        if (reload_all) {
+                bindings_get_entries (manager);
+        } else {
+                GHashTableIter iter;
+                gpointer       path;
+
+                if (g_hash_table_size (paths) == 0) {
+                        g_hash_table_destroy (paths);
+                        return;
+                }
+
+                g_hash_table_iter_init (&iter, paths);
+                while (g_hash_table_iter_next (&iter, &path, NULL))
+                        bindings_get_entry (manager, path);
+        }
+
+        g_debug ("keybindings: %s, %u bindings",
+                 reload_all ? "reloaded all bindings" : "updated changed bindings",
+                 g_hash_table_size (manager->priv->bindings));
+        g_hash_table_destroy (paths);
 
-        binding_register_keys (manager);
+        bindings_apply (manager);
 }
 
 gboolean
@@ -560,9 +494,12 @@ msd_keybindings_manager_start (MsdKeybindingsManager *manager,
 
         manager->priv->screens = get_screens_list ();
 
-        manager->priv->binding_list = NULL;
+        manager->priv->bindings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                         NULL, (GDestroyNotify) binding_free);
+        manager->priv->key_table = msd_key_table_new ();
+        manager->priv->grab_set = msd_grab_set_new ();
         bindings_get_entries (manager);
-        binding_register_keys (manager);
+        bindings_apply (manager);
 
         manager->priv->client = dconf_client_new ();
         dconf_client_watch_fast (manager->priv->client, GSETTINGS_KEYBINDINGS_DIR);
@@ -605,8 +542,9 @@ msd_keybindings_manager_stop (MsdKeybindingsManager *manager)
                                           manager);
         }
 
-        binding_unregister_keys (manager);
-        bindings_clear (manager);
+        g_clear_pointer (&p->grab_set, msd_grab_set_free);
+        g_clear_pointer (&p->key_table, msd_key_table_free);
+        g_clear_pointer (&p->bindings, g_hash_table_destroy);
 
         g_slist_free (p->screens);
         p->screens = NULL;
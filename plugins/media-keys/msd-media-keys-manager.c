@@ -48,6 +48,7 @@
 #include "acme.h"
 #include "msd-media-keys-window.h"
 #include "msd-input-helper.h"
+#include "msd-spawn.h"
 
 #define MSD_DBUS_PATH "/org/mate/SettingsDaemon"
 #define MSD_DBUS_NAME "org.mate.SettingsDaemon"
@@ -100,6 +101,12 @@ struct _MsdMediaKeysManagerPrivate
         GdkScreen        *current_screen;
         GSList           *screens;
 
+        /* Grabbed keys, mapping to their index in keys[] + 1 */
+        MsdKeyTable      *key_table;
+
+        /* Command lines launched so far, mapping to their parsed argv */
+        GHashTable       *argv_cache;
+
         /* RFKill stuff */
         guint            rfkill_watch_id;
         GDBusProxy      *rfkill_proxy;
@@ -191,7 +198,6 @@ execute (MsdMediaKeysManager *manager,
 {
         gboolean retval;
         char   **argv;
-        int      argc;
         char    *exec;
         char    *term = NULL;
 
@@ -213,7 +219,16 @@ execute (MsdMediaKeysManager *manager,
                 exec = g_strdup (cmd);
         }
 
-        if (g_shell_parse_argv (exec, &argc, &argv, NULL)) {
+        if (manager->priv->argv_cache == NULL)
+                manager->priv->argv_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                   g_free, (GDestroyNotify) g_strfreev);
+
+        /* the commands come from a handful of settings, parse each once */
+        argv = g_hash_table_lookup (manager->priv->argv_cache, exec);
+        if (argv == NULL && g_shell_parse_argv (exec, NULL, &argv, NULL))
+                g_hash_table_insert (manager->priv->argv_cache, g_strdup (exec), argv);
+
+        if (argv != NULL) {
                 if (sync != FALSE) {
                         retval = g_spawn_sync (g_get_home_dir (),
                                                argv,
@@ -226,16 +241,8 @@ execute (MsdMediaKeysManager *manager,
                                                NULL,
                                                NULL);
                 } else {
-                        retval = g_spawn_async (g_get_home_dir (),
-                                                argv,
-                                                NULL,
-                                                G_SPAWN_SEARCH_PATH,
-                                                NULL,
-                                                NULL,
-                                                NULL,
-                                                NULL);
+                        retval = msd_spawn_async (g_get_home_dir (), argv, NULL, NULL);
                 }
-                g_strfreev (argv);
         }
 
         if (retval == FALSE) {
@@ -277,6 +284,22 @@ is_valid_shortcut (const char *string)
         return TRUE;
 }
 
+static void
+rebuild_key_table (MsdMediaKeysManager *manager)
+{
+        int i;
+
+        if (manager->priv->key_table == NULL)
+                return;
+
+        msd_key_table_remove_all (manager->priv->key_table);
+
+        for (i = 0; i < HANDLED_KEYS; i++) {
+                if (keys[i].key != NULL)
+                        msd_key_table_add (manager->priv->key_table, keys[i].key, GINT_TO_POINTER (i + 1));
+        }
+}
+
 static void
 update_kbd_cb (GSettings           *settings,
                gchar               *settings_key,
@@ -333,6 +356,8 @@ update_kbd_cb (GSettings           *settings,
                 }
         }
 
+        rebuild_key_table (manager);
+
         if (need_flush)
                 gdk_display_flush (dpy);
         if (gdk_x11_display_error_trap_pop (dpy))
@@ -404,6 +429,9 @@ static void init_kbd(MsdMediaKeysManager* manager)
 		g_warning("Grab failed for some keys, another application may already have access the them.");
 	}
 
+	manager->priv->key_table = msd_key_table_new ();
+	rebuild_key_table (manager);
+
 	mate_settings_profile_end(NULL);
 }
 
@@ -1484,28 +1512,31 @@ acme_filter_events (GdkXEvent           *xevent,
                 return GDK_FILTER_CONTINUE;
         }
 
-        for (i = 0; i < HANDLED_KEYS; i++) {
-                if (match_key (keys[i].key, xev)) {
-                        switch (keys[i].key_type) {
-                        case VOLUME_DOWN_KEY:
-                        case VOLUME_UP_KEY:
-                        case VOLUME_DOWN_QUIET_KEY:
-                        case VOLUME_UP_QUIET_KEY:
-                                /* auto-repeatable keys */
-                                if (xev->type != KeyPress) {
-                                        return GDK_FILTER_CONTINUE;
-                                }
-                                break;
-                        }
+        if (manager->priv->key_table == NULL) {
+                return GDK_FILTER_CONTINUE;
+        }
 
-                        manager->priv->current_screen = acme_get_screen_from_event (manager, xany);
+        i = GPOINTER_TO_INT (msd_key_table_lookup (manager->priv->key_table, xev)) - 1;
+        if (i < 0) {
+                return GDK_FILTER_CONTINUE;
+        }
 
-                        if (do_action (manager, keys[i].key_type) == FALSE) {
-                                return GDK_FILTER_REMOVE;
-                        } else {
-                                return GDK_FILTER_CONTINUE;
-                        }
+        switch (keys[i].key_type) {
+        case VOLUME_DOWN_KEY:
+        case VOLUME_UP_KEY:
+        case VOLUME_DOWN_QUIET_KEY:
+        case VOLUME_UP_QUIET_KEY:
+                /* auto-repeatable keys */
+                if (xev->type != KeyPress) {
+                        return GDK_FILTER_CONTINUE;
                 }
+                break;
+        }
+
+        manager->priv->current_screen = acme_get_screen_from_event (manager, xany);
+
+        if (do_action (manager, keys[i].key_type) == FALSE) {
+                return GDK_FILTER_REMOVE;
         }
 
         return GDK_FILTER_CONTINUE;
@@ -1727,6 +1758,9 @@ msd_media_keys_manager_stop (MsdMediaKeysManager *manager)
         dpy = gdk_display_get_default ();
         gdk_x11_display_error_trap_push (dpy);
 
+        g_clear_pointer (&priv->key_table, msd_key_table_free);
+        g_clear_pointer (&priv->argv_cache, g_hash_table_destroy);
+
         for (i = 0; i < HANDLED_KEYS; ++i) {
                 if (keys[i].key) {
                         need_flush = TRUE;
@@ -53,10 +53,12 @@
 
 struct MsdMprisManagerPrivate
 {
-        GQueue       *media_player_queue;
-        GDBusProxy   *media_keys_proxy;
-        guint         watch_id;
-        guint         namespace_watcher_id;
+        GQueue          *media_player_queue;
+        GHashTable      *player_owners;   /* bus name -> unique name of its owner */
+        GDBusConnection *connection;
+        GDBusProxy      *media_keys_proxy;
+        guint            watch_id;
+        guint            namespace_watcher_id;
 };
 
 enum {
@@ -99,6 +101,12 @@ mp_name_appeared (GDBusConnection  *connection,
 
     g_debug ("MPRIS Name acquired: %s\n", name);
 
+    /* remember where to send the keys, so that a key press
+     * needs no lookup on the bus */
+    g_set_object (&manager->priv->connection, connection);
+    g_hash_table_replace (manager->priv->player_owners,
+                          g_strdup (name), g_strdup (name_owner));
+
     player_name = get_player_name(name);
     g_queue_push_head (manager->priv->media_player_queue,
                        player_name);
@@ -115,6 +123,8 @@ mp_name_vanished (GDBusConnection *connection,
     gchar *player_name;
     GList *player_list;
 
+    g_hash_table_remove (manager->priv->player_owners, name);
+
     if (g_queue_is_empty (manager->priv->media_player_queue))
         return;
 
@@ -125,8 +135,10 @@ mp_name_vanished (GDBusConnection *connection,
     player_list = g_queue_find_custom (manager->priv->media_player_queue,
                                        player_name, (GCompareFunc) g_strcmp0);
 
-    if (player_list)
-        g_queue_remove (manager->priv->media_player_queue, player_list->data);
+    if (player_list) {
+        g_free (player_list->data);
+        g_queue_delete_link (manager->priv->media_player_queue, player_list);
+    }
 
     g_free (player_name);
 }
@@ -137,11 +149,9 @@ static void
 on_media_player_key_pressed (MsdMprisManager  *manager,
                              const gchar      *key)
 {
-    GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
-    GDBusProxy *proxy = NULL;
-    GError *error = NULL;
     const char *mpris_key = NULL;
     const char *mpris_head = NULL;
+    const char *mpris_owner = NULL;
     char *mpris_name = NULL;
 
     if (g_queue_is_empty (manager->priv->media_player_queue))
@@ -162,30 +172,24 @@ on_media_player_key_pressed (MsdMprisManager  *manager,
     {
         mpris_head = g_queue_peek_head (manager->priv->media_player_queue);
         mpris_name = g_strdup_printf (MPRIS_PREFIX "%s", mpris_head);
-
-        g_debug ("MPRIS Sending '%s' to '%s'!", mpris_key, mpris_head);
-
-        proxy = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                              flags,
-                                              NULL,
-                                              mpris_name,
-                                              MPRIS_OBJECT_PATH,
-                                              MPRIS_INTERFACE,
-                                              NULL,
-                                              &error);
+        mpris_owner = g_hash_table_lookup (manager->priv->player_owners, mpris_name);
         g_free (mpris_name);
-        if (proxy == NULL)
-        {
-            g_printerr("Error creating proxy: %s\n", error->message);
-            g_error_free(error);
+
+        if (mpris_owner == NULL || manager->priv->connection == NULL)
             return;
-        }
 
-        g_dbus_proxy_call (proxy, mpris_key, NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1, NULL, NULL, NULL);
-        g_object_unref (proxy);
+        g_debug ("MPRIS Sending '%s' to '%s'!", mpris_key, mpris_head);
 
+        /* fire and forget, a slow player must not hold up the key */
+        g_dbus_connection_call (manager->priv->connection,
+                                mpris_owner,
+                                MPRIS_OBJECT_PATH,
+                                MPRIS_INTERFACE,
+                                mpris_key,
+                                NULL,
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                -1, NULL, NULL, NULL);
     }
 }
 
@@ -301,6 +305,8 @@ msd_mpris_manager_start (MsdMprisManager   *manager,
     mate_settings_profile_start (NULL);
 
     manager->priv->media_player_queue = g_queue_new();
+    manager->priv->player_owners = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free, g_free);
 
     /* Register the namespace we wish to watch. */
     manager->priv->namespace_watcher_id = bus_watch_namespace (G_BUS_TYPE_SESSION,
@@ -341,6 +347,13 @@ msd_mpris_manager_stop (MsdMprisManager *manager)
         manager->priv->namespace_watcher_id = 0;
     }
 
+    if (manager->priv->media_player_queue != NULL) {
+        g_queue_free_full (manager->priv->media_player_queue, g_free);
+        manager->priv->media_player_queue = NULL;
+    }
+
+    g_clear_pointer (&manager->priv->player_owners, g_hash_table_destroy);
+    g_clear_object (&manager->priv->connection);
 }
 
 static void
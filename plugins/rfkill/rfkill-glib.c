@@ -404,7 +404,7 @@ cc_rfkill_glib_open (CcRfkillGlib *rfkill)
 
 	priv = rfkill->priv;
 
-	fd = open("/dev/rfkill", O_RDWR);
+	fd = open("/dev/rfkill", O_RDWR | O_CLOEXEC);
 	if (fd < 0) {
 		if (errno == EACCES)
 			g_warning ("Could not open RFKILL control device, please verify your installation");
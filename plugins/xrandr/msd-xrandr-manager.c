@@ -168,7 +168,7 @@ log_open (void)
         if (stat (toggle_filename, &st) != 0)
                 goto out;
 
-        log_file = fopen (log_filename, "a");
+        log_file = fopen (log_filename, "ae");
 
         if (log_file && ftell (log_file) == 0)
                 fprintf (log_file, "To keep this log from being created, please rm ~/msd-debug-randr\n");
@@ -22,6 +22,8 @@
 
 #include "fontconfig-monitor.h"
 
+#include <time.h>
+
 #include <gio/gio.h>
 #include <fontconfig/fontconfig.h>
 
@@ -46,83 +48,201 @@ fontconfig_cache_update (void)
         return !FcConfigUptoDate (NULL) && FcInitReinitialize ();
 }
 
+struct _fontconfig_monitor_handle {
+        GHashTable *monitors;   /* path -> GFileMonitor */
+
+        guint timeout;
+
+        /* The rescan runs in a worker thread; changes arriving meanwhile
+         * only schedule another rescan once it has finished. */
+        gboolean rescanning;
+        gboolean rescan_pending;
+        gboolean stopped;
+
+        time_t timestamp;
+
+        GFunc    notify_callback;
+        gpointer notify_data;
+};
+
+typedef struct {
+        gboolean    changed;
+        GHashTable *paths;
+        time_t      timestamp;
+} RescanResult;
+
 static void
-monitor_files (GPtrArray *monitors,
-               FcStrList *list,
-               gpointer   data)
+collect_paths (GHashTable *paths,
+               FcStrList  *list)
 {
         const char *str;
 
-        while ((str = (const char *) FcStrListNext (list))) {
-                GFile *file;
-                GFileMonitor *monitor;
+        while ((str = (const char *) FcStrListNext (list)))
+                g_hash_table_add (paths, g_strdup (str));
+
+        FcStrListDone (list);
+}
+
+/* The config files and font directories of the current configuration */
+static GHashTable *
+get_monitored_paths (void)
+{
+        GHashTable *paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        collect_paths (paths, FcConfigGetConfigFiles (NULL));
+        collect_paths (paths, FcConfigGetFontDirs (NULL));
+
+        return paths;
+}
+
+static void
+monitor_free (GFileMonitor *monitor)
+{
+        g_file_monitor_cancel (monitor);
+        g_object_unref (monitor);
+}
 
-                file = g_file_new_for_path (str);
+static void
+monitor_path (fontconfig_monitor_handle_t *handle,
+              const char                  *path)
+{
+        GFile *file;
+        GFileMonitor *monitor;
 
-                monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        file = g_file_new_for_path (path);
 
-                g_object_unref (file);
+        monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
 
-                if (!monitor)
-                        continue;
+        g_object_unref (file);
 
-                g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), data);
+        if (!monitor)
+                return;
 
-                g_ptr_array_add (monitors, monitor);
-        }
+        g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), handle);
 
-        FcStrListDone (list);
+        g_hash_table_insert (handle->monitors, g_strdup (path), monitor);
 }
 
-struct _fontconfig_monitor_handle {
-        GPtrArray *monitors;
+/* Only touch the monitors of paths that appeared or went away */
+static void
+monitors_update (fontconfig_monitor_handle_t *handle,
+                 GHashTable                  *paths)
+{
+        GHashTableIter iter;
+        gpointer key;
+        guint removed = 0;
+        guint added = 0;
+
+        g_hash_table_iter_init (&iter, handle->monitors);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (!g_hash_table_contains (paths, key)) {
+                        g_hash_table_iter_remove (&iter);
+                        removed++;
+                }
+        }
 
-        guint timeout;
+        g_hash_table_iter_init (&iter, paths);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (!g_hash_table_contains (handle->monitors, key)) {
+                        monitor_path (handle, key);
+                        added++;
+                }
+        }
 
-        GFunc    notify_callback;
-        gpointer notify_data;
-};
+        g_debug ("fontconfig: %u monitors added, %u removed, %u in total",
+                 added, removed, g_hash_table_size (handle->monitors));
+}
+
+static void
+handle_free (fontconfig_monitor_handle_t *handle)
+{
+        g_clear_pointer (&handle->monitors, g_hash_table_destroy);
+        g_slice_free (fontconfig_monitor_handle_t, handle);
+}
 
-static GPtrArray *
-monitors_create (gpointer data)
+static void
+rescan_result_free (RescanResult *result)
 {
-        GPtrArray *monitors = g_ptr_array_new ();
+        if (result->paths)
+                g_hash_table_destroy (result->paths);
+        g_free (result);
+}
 
-        monitor_files (monitors, FcConfigGetConfigFiles (NULL), data);
-        monitor_files (monitors, FcConfigGetFontDirs (NULL)   , data);
+static void
+rescan_thread (GTask        *task,
+               gpointer      source_object G_GNUC_UNUSED,
+               gpointer      task_data G_GNUC_UNUSED,
+               GCancellable *cancellable G_GNUC_UNUSED)
+{
+        RescanResult *result = g_new0 (RescanResult, 1);
 
-        return monitors;
+        result->changed = fontconfig_cache_update ();
+        if (result->changed) {
+                result->paths = get_monitored_paths ();
+                result->timestamp = time (NULL);
+        }
+
+        g_task_return_pointer (task, result, (GDestroyNotify) rescan_result_free);
 }
 
+static gboolean update (gpointer data);
+
 static void
-monitors_free (GPtrArray *monitors)
+rescan_done (GObject      *source_object G_GNUC_UNUSED,
+             GAsyncResult *res,
+             gpointer      data)
 {
-        if (!monitors)
+        fontconfig_monitor_handle_t *handle = data;
+        RescanResult *result;
+        gboolean notify;
+
+        result = g_task_propagate_pointer (G_TASK (res), NULL);
+        handle->rescanning = FALSE;
+
+        if (handle->stopped) {
+                rescan_result_free (result);
+                handle_free (handle);
                 return;
+        }
+
+        notify = result->changed;
+        if (notify) {
+                monitors_update (handle, result->paths);
+                handle->timestamp = result->timestamp;
+        }
+        rescan_result_free (result);
 
-        g_ptr_array_foreach (monitors, (GFunc) g_object_unref, NULL);
-        g_ptr_array_free (monitors, TRUE);
+        if (handle->rescan_pending) {
+                handle->rescan_pending = FALSE;
+                if (handle->timeout == 0)
+                        handle->timeout = g_timeout_add_seconds (TIMEOUT_SECONDS, update, handle);
+        }
+
+        /* we finish modifying handle before calling the notify callback,
+         * allowing the callback to free the monitor if it decides to. */
+
+        if (notify && handle->notify_callback)
+                handle->notify_callback (handle, handle->notify_data);
 }
 
 static gboolean
 update (gpointer data)
 {
         fontconfig_monitor_handle_t *handle = data;
-        gboolean notify = FALSE;
+        GTask *task;
 
         handle->timeout = 0;
 
-        if (fontconfig_cache_update ()) {
-                notify = TRUE;
-                monitors_free (handle->monitors);
-                handle->monitors = monitors_create (data);
+        if (handle->rescanning) {
+                handle->rescan_pending = TRUE;
+                return FALSE;
         }
 
-        /* we finish modifying handle before calling the notify callback,
-         * allowing the callback to free the monitor if it decides to. */
+        handle->rescanning = TRUE;
 
-        if (notify && handle->notify_callback)
-                handle->notify_callback (data, handle->notify_data);
+        task = g_task_new (NULL, NULL, rescan_done, handle);
+        g_task_run_in_thread (task, rescan_thread);
+        g_object_unref (task);
 
         return FALSE;
 }
@@ -136,6 +256,12 @@ stuff_changed (GFileMonitor *monitor G_GNUC_UNUSED,
 {
         fontconfig_monitor_handle_t *handle = data;
 
+        /* rescan_done() arms the timer again, so that only one exists */
+        if (handle->rescanning) {
+                handle->rescan_pending = TRUE;
+                return;
+        }
+
         /* wait for quiescence */
         if (handle->timeout)
                 g_source_remove (handle->timeout);
@@ -148,14 +274,31 @@ fontconfig_monitor_start (GFunc    notify_callback,
                           gpointer notify_data)
 {
         fontconfig_monitor_handle_t *handle = g_slice_new0 (fontconfig_monitor_handle_t);
+        GHashTable *paths;
+        GHashTableIter iter;
+        gpointer key;
 
         handle->notify_callback = notify_callback;
         handle->notify_data = notify_data;
-        handle->monitors = monitors_create (handle);
+        handle->timestamp = time (NULL);
+        handle->monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free, (GDestroyNotify) monitor_free);
+
+        paths = get_monitored_paths ();
+        g_hash_table_iter_init (&iter, paths);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+                monitor_path (handle, key);
+        g_hash_table_destroy (paths);
 
         return handle;
 }
 
+time_t
+fontconfig_monitor_get_timestamp (fontconfig_monitor_handle_t *handle)
+{
+        return handle->timestamp;
+}
+
 void
 fontconfig_monitor_stop  (fontconfig_monitor_handle_t *handle)
 {
@@ -163,8 +306,14 @@ fontconfig_monitor_stop  (fontconfig_monitor_handle_t *handle)
           g_source_remove (handle->timeout);
         handle->timeout = 0;
 
-        monitors_free (handle->monitors);
-        handle->monitors = NULL;
+        /* a running rescan frees the handle once it returns */
+        if (handle->rescanning) {
+                g_clear_pointer (&handle->monitors, g_hash_table_destroy);
+                handle->stopped = TRUE;
+                return;
+        }
+
+        handle_free (handle);
 }
 
 #ifdef FONTCONFIG_MONITOR_TEST
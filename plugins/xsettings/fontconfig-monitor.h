@@ -22,6 +22,8 @@
 #ifndef __FONTCONFIG_MONITOR_H
 #define __FONTCONFIG_MONITOR_H
 
+#include <time.h>
+
 #include <glib.h>
 
 #ifdef __cplusplus
@@ -37,6 +39,7 @@ fontconfig_monitor_handle_t *
 fontconfig_monitor_start (GFunc    notify_callback,
                           gpointer notify_data);
 void fontconfig_monitor_stop  (fontconfig_monitor_handle_t *handle);
+time_t fontconfig_monitor_get_timestamp (fontconfig_monitor_handle_t *handle);
 
 #ifdef __cplusplus
 }
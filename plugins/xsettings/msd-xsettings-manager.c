@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
@@ -110,15 +111,40 @@ struct _TranslationEntry {
         TranslationFunc translate;
 };
 
+/* One logical line of RESOURCE_MANAGER; continuation lines are kept
+ * together so the original text can be written back unchanged. */
+typedef struct {
+        gchar       *text;
+        gchar       *key;       /* NULL for comments and blank lines */
+        const gchar *value;     /* points into @text */
+} XResourceLine;
+
+typedef struct {
+        GPtrArray  *lines;
+        GHashTable *index;      /* key -> XResourceLine */
+        gchar      *text;       /* serialization of @lines */
+        gboolean    changed;
+} XResourceDb;
+
 struct MateXSettingsManagerPrivate
 {
         XSettingsManager **managers;
         Display          *xdisplay;
         GHashTable *gsettings;
+        GHashTable *translation_index;
         GSettings *gsettings_font;
         GSettings *plugin_settings;
         fontconfig_monitor_handle_t *fontconfig_handle;
         gint window_scale;
+        XResourceDb *xresources;
+
+        /* Changes are applied to the settings right away but published
+         * from a single idle flush per burst. */
+        guint flush_id;
+        gboolean xft_dirty;
+        guint pending_changes;
+        guint64 n_changes;
+        guint64 n_notifications;
 };
 
 #define MSD_XSETTINGS_ERROR msd_xsettings_error_quark ()
@@ -597,81 +623,213 @@ xft_settings_set_xsettings (MateXSettingsManager *manager,
 }
 
 static void
-update_property (GString *props, const gchar* key, const gchar* value)
+xresource_line_free (XResourceLine *line)
 {
-        gchar* needle;
-        size_t needle_len;
-        gchar* found = NULL;
-
-        /* update an existing property */
-        needle = g_strconcat (key, ":", NULL);
-        needle_len = strlen (needle);
-        if (g_str_has_prefix (props->str, needle))
-                found = props->str;
-        else
-                found = strstr (props->str, needle);
+        g_free (line->text);
+        g_free (line->key);
+        g_free (line);
+}
 
-        if (found) {
-                size_t value_index;
-                gchar* end;
+static void
+xresource_line_set_text (XResourceLine *line,
+                         gchar         *text)
+{
+        const gchar *colon;
 
-                end = strchr (found, '\n');
-                value_index = (found - props->str) + needle_len + 1;
-                g_string_erase (props, value_index, end ? (end - found - needle_len) : -1);
-                g_string_insert (props, value_index, "\n");
-                g_string_insert (props, value_index, value);
-        } else {
-                g_string_append_printf (props, "%s:\t%s\n", key, value);
+        g_free (line->text);
+        g_free (line->key);
+        line->text = text;
+        line->key = NULL;
+        line->value = NULL;
+
+        if (text[0] == '!' || text[0] == '#')
+                return;
+
+        colon = strchr (text, ':');
+        if (colon == NULL)
+                return;
+
+        line->key = g_strstrip (g_strndup (text, colon - text));
+        if (line->key[0] == '\0') {
+                g_clear_pointer (&line->key, g_free);
+                return;
         }
 
-        g_free (needle);
+        line->value = colon + 1;
+        while (*line->value == ' ' || *line->value == '\t')
+                line->value++;
 }
 
 static void
-xft_settings_set_xresources (MateXftSettings *settings)
+xresource_db_free (XResourceDb *db)
 {
-        GString    *add_string;
-        char        dpibuf[G_ASCII_DTOSTR_BUF_SIZE];
-        Display    *dpy;
+        g_hash_table_destroy (db->index);
+        g_ptr_array_free (db->lines, TRUE);
+        g_free (db->text);
+        g_free (db);
+}
 
-        mate_settings_profile_start (NULL);
+static XResourceDb *
+xresource_db_parse (const gchar *text)
+{
+        XResourceDb  *db;
+        gchar       **split;
+        int           i;
+
+        db = g_new0 (XResourceDb, 1);
+        db->lines = g_ptr_array_new_with_free_func ((GDestroyNotify) xresource_line_free);
+        db->index = g_hash_table_new (g_str_hash, g_str_equal);
+        db->text = g_strdup (text);
+
+        split = g_strsplit (text, "\n", -1);
+        for (i = 0; split[i] != NULL; i++) {
+                XResourceLine *line;
+                GString       *buf;
+
+                /* the terminating newline leaves an empty last piece */
+                if (split[i + 1] == NULL && split[i][0] == '\0')
+                        break;
+
+                buf = g_string_new (split[i]);
+                while (buf->len > 0 && buf->str[buf->len - 1] == '\\' && split[i + 1] != NULL) {
+                        g_string_append_c (buf, '\n');
+                        g_string_append (buf, split[++i]);
+                }
 
-        /* get existing properties */
-        dpy = XOpenDisplay (NULL);
-        if (dpy == NULL) {
-                g_warning ("Unable to open X display for X resources");
-                mate_settings_profile_end (NULL);
+                line = g_new0 (XResourceLine, 1);
+                xresource_line_set_text (line, g_string_free (buf, FALSE));
+                g_ptr_array_add (db->lines, line);
+
+                /* the last definition of a resource is the one that counts */
+                if (line->key != NULL)
+                        g_hash_table_replace (db->index, line->key, line);
+        }
+        g_strfreev (split);
+
+        return db;
+}
+
+static void
+xresource_db_set (XResourceDb *db,
+                  const gchar *key,
+                  const gchar *value)
+{
+        XResourceLine *line;
+
+        line = g_hash_table_lookup (db->index, key);
+        if (line != NULL && g_str_equal (line->value, value))
                 return;
+
+        if (line == NULL) {
+                line = g_new0 (XResourceLine, 1);
+                g_ptr_array_add (db->lines, line);
+        } else {
+                /* the index borrows line->key, which is about to change */
+                g_hash_table_remove (db->index, key);
         }
-        add_string = g_string_new (XResourceManagerString (dpy));
 
-        g_debug("xft_settings_set_xresources: orig res '%s'", add_string->str);
+        xresource_line_set_text (line, g_strdup_printf ("%s:\t%s", key, value));
+        g_hash_table_insert (db->index, line->key, line);
+        db->changed = TRUE;
+}
+
+static void
+xresource_db_serialize (XResourceDb *db)
+{
+        GString *str;
+        guint    i;
+
+        str = g_string_sized_new (strlen (db->text) + 256);
+        for (i = 0; i < db->lines->len; i++) {
+                XResourceLine *line = g_ptr_array_index (db->lines, i);
+
+                g_string_append (str, line->text);
+                g_string_append_c (str, '\n');
+        }
+
+        g_free (db->text);
+        db->text = g_string_free (str, FALSE);
+        db->changed = FALSE;
+}
+
+static gchar *
+get_resource_manager (Display *dpy)
+{
+        Atom           type;
+        int            format;
+        unsigned long  nitems;
+        unsigned long  bytes_after;
+        unsigned char *data = NULL;
+        gchar         *text;
+
+        if (XGetWindowProperty (dpy, RootWindow (dpy, 0), XA_RESOURCE_MANAGER,
+                                0, G_MAXLONG, False, XA_STRING,
+                                &type, &format, &nitems, &bytes_after,
+                                &data) == Success &&
+            type == XA_STRING && format == 8 && data != NULL)
+                text = g_strndup ((const gchar *) data, nitems);
+        else
+                text = g_strdup ("");
+
+        if (data != NULL)
+                XFree (data);
+
+        return text;
+}
+
+static void
+xft_settings_set_xresources (MateXSettingsManager *manager,
+                             MateXftSettings      *settings)
+{
+        char         dpibuf[G_ASCII_DTOSTR_BUF_SIZE];
+        Display     *dpy = manager->priv->xdisplay;
+        XResourceDb *db;
+        gchar       *current;
+
+        if (dpy == NULL)
+                return;
+
+        mate_settings_profile_start (NULL);
+
+        /* Only reparse when someone else (e.g. xrdb) rewrote the
+         * property since we last wrote it. */
+        current = get_resource_manager (dpy);
+        db = manager->priv->xresources;
+        if (db == NULL || !g_str_equal (db->text, current)) {
+                g_debug ("xft_settings_set_xresources: parsing res '%s'", current);
+                g_clear_pointer (&manager->priv->xresources, xresource_db_free);
+                db = manager->priv->xresources = xresource_db_parse (current);
+        }
+        g_free (current);
 
         g_snprintf (dpibuf, sizeof (dpibuf), "%d", (int) (settings->scaled_dpi / 1024.0 + 0.5));
-        update_property (add_string, "Xft.dpi", dpibuf);
-        update_property (add_string, "Xft.antialias",
-                                settings->antialias ? "1" : "0");
-        update_property (add_string, "Xft.hinting",
-                                settings->hinting ? "1" : "0");
-        update_property (add_string, "Xft.hintstyle",
-                                settings->hintstyle);
-        update_property (add_string, "Xft.rgba",
-                                settings->rgba);
-        update_property (add_string, "Xft.lcdfilter",
-                         g_str_equal (settings->rgba, "rgb") ? "lcddefault" : "none");
-        update_property (add_string, "Xcursor.theme",
-                                settings->cursor_theme);
-        update_property (add_string, "Xcursor.size",
-                                g_ascii_dtostr (dpibuf, sizeof (dpibuf), (double) settings->cursor_size));
-
-        g_debug("xft_settings_set_xresources: new res '%s'", add_string->str);
-
-        /* Set the new X property */
-        XChangeProperty(dpy, RootWindow (dpy, 0),
-                XA_RESOURCE_MANAGER, XA_STRING, 8, PropModeReplace, (unsigned char *) add_string->str, add_string->len);
-        XCloseDisplay (dpy);
-
-        g_string_free (add_string, TRUE);
+        xresource_db_set (db, "Xft.dpi", dpibuf);
+        xresource_db_set (db, "Xft.antialias",
+                          settings->antialias ? "1" : "0");
+        xresource_db_set (db, "Xft.hinting",
+                          settings->hinting ? "1" : "0");
+        xresource_db_set (db, "Xft.hintstyle",
+                          settings->hintstyle);
+        xresource_db_set (db, "Xft.rgba",
+                          settings->rgba);
+        xresource_db_set (db, "Xft.lcdfilter",
+                          g_str_equal (settings->rgba, "rgb") ? "lcddefault" : "none");
+        xresource_db_set (db, "Xcursor.theme",
+                          settings->cursor_theme);
+        xresource_db_set (db, "Xcursor.size",
+                          g_ascii_dtostr (dpibuf, sizeof (dpibuf), (double) settings->cursor_size));
+
+        if (db->changed) {
+                xresource_db_serialize (db);
+
+                g_debug ("xft_settings_set_xresources: new res '%s'", db->text);
+
+                /* Set the new X property */
+                XChangeProperty (dpy, RootWindow (dpy, 0),
+                                 XA_RESOURCE_MANAGER, XA_STRING, 8, PropModeReplace,
+                                 (unsigned char *) db->text, strlen (db->text));
+                XFlush (dpy);
+        }
 
         mate_settings_profile_end (NULL);
 }
@@ -688,26 +846,72 @@ update_xft_settings (MateXSettingsManager *manager)
 
         xft_settings_get (manager, &settings);
         xft_settings_set_xsettings (manager, &settings);
-        xft_settings_set_xresources (&settings);
+        xft_settings_set_xresources (manager, &settings);
 
         mate_settings_profile_end (NULL);
 }
 
+static gboolean
+flush_changes_cb (MateXSettingsManager *manager)
+{
+        int i;
+
+        manager->priv->flush_id = 0;
+
+        if (manager->priv->xft_dirty) {
+                manager->priv->xft_dirty = FALSE;
+                update_xft_settings (manager);
+        }
+
+        for (i = 0; manager->priv->managers [i]; i++) {
+                xsettings_manager_set_string (manager->priv->managers [i],
+                                              "Net/FallbackIconTheme",
+                                              "mate");
+        }
+
+        for (i = 0; manager->priv->managers [i]; i++) {
+                xsettings_manager_notify (manager->priv->managers [i]);
+        }
+
+        manager->priv->n_notifications++;
+        g_debug ("xsettings: published %u changes at once "
+                 "(%" G_GUINT64_FORMAT " changes, %" G_GUINT64_FORMAT " notifications so far)",
+                 manager->priv->pending_changes,
+                 manager->priv->n_changes, manager->priv->n_notifications);
+        manager->priv->pending_changes = 0;
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Records a change and schedules a flush; @xft requests that the Xft
+ * settings and X resources are recomputed first. */
+static void
+queue_flush (MateXSettingsManager *manager,
+             gboolean              xft)
+{
+        if (xft)
+                manager->priv->xft_dirty = TRUE;
+
+        manager->priv->pending_changes++;
+        manager->priv->n_changes++;
+
+        if (manager->priv->flush_id == 0)
+                manager->priv->flush_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                                           (GSourceFunc) flush_changes_cb,
+                                                           manager,
+                                                           NULL);
+}
+
 static void
 recalculate_scale_callback (GdkScreen            *screen G_GNUC_UNUSED,
                             MateXSettingsManager *manager)
 {
-        int i;
         int new_scale = get_window_scale (manager);
 
         if (manager->priv->window_scale == new_scale)
                 return;
 
-        update_xft_settings (manager);
-
-        for (i = 0; manager->priv->managers [i]; i++) {
-                xsettings_manager_notify (manager->priv->managers [i]);
-        }
+        queue_flush (manager, TRUE);
 }
 
 static void
@@ -715,13 +919,7 @@ xft_callback (GSettings            *gsettings G_GNUC_UNUSED,
               const gchar          *key G_GNUC_UNUSED,
               MateXSettingsManager *manager)
 {
-        int i;
-
-        update_xft_settings (manager);
-
-        for (i = 0; manager->priv->managers [i]; i++) {
-                xsettings_manager_notify (manager->priv->managers [i]);
-        }
+        queue_flush (manager, TRUE);
 }
 
 static void
@@ -736,10 +934,11 @@ override_callback (GSettings            *settings,
 
         for (i = 0; manager->priv->managers [i]; i++) {
                 xsettings_manager_set_overrides (manager->priv->managers [i], value);
-                xsettings_manager_notify (manager->priv->managers [i]);
         }
 
         g_variant_unref (value);
+
+        queue_flush (manager, FALSE);
 }
 
 static void
@@ -757,14 +956,15 @@ fontconfig_callback (fontconfig_monitor_handle_t *handle,
                      MateXSettingsManager       *manager)
 {
         int i;
-        int timestamp = time (NULL);
+        int timestamp = fontconfig_monitor_get_timestamp (handle);
 
         mate_settings_profile_start (NULL);
 
         for (i = 0; manager->priv->managers [i]; i++) {
                 xsettings_manager_set_int (manager->priv->managers [i], "Fontconfig/Timestamp", timestamp);
-                xsettings_manager_notify (manager->priv->managers [i]);
         }
+        queue_flush (manager, FALSE);
+
         mate_settings_profile_end (NULL);
 }
 
@@ -809,25 +1009,76 @@ process_value (MateXSettingsManager *manager,
         (* trans->translate) (manager, trans, value);
 }
 
-static TranslationEntry *
-find_translation_entry (GSettings *gsettings, const char *key)
+/* Translations are looked up by (schema, key) on every change
+ * notification; both are reduced to quarks, the schema one being
+ * attached to each GSettings instance when it is created.
+ */
+static GQuark
+schema_qdata_quark (void)
+{
+        return g_quark_from_static_string ("msd-xsettings-schema");
+}
+
+static gint64 *
+translation_index_key (GQuark schema,
+                       GQuark key)
 {
-        guint i;
-        char *schema;
+        gint64 *index_key;
+
+        index_key = g_new (gint64, 1);
+        *index_key = ((gint64) schema << 32) | key;
 
-        g_object_get (gsettings, "schema", &schema, NULL);
+        return index_key;
+}
+
+static GHashTable *
+translation_index_new (void)
+{
+        GHashTable *index;
+        guint       i;
+
+        index = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
 
         for (i = 0; i < G_N_ELEMENTS (translations); i++) {
-                if (g_str_equal (schema, translations[i].gsettings_schema) &&
-                    g_str_equal (key, translations[i].gsettings_key)) {
-                            g_free (schema);
-                        return &translations[i];
-                }
+                g_hash_table_insert (index,
+                                     translation_index_key (g_quark_from_static_string (translations[i].gsettings_schema),
+                                                            g_quark_from_static_string (translations[i].gsettings_key)),
+                                     &translations[i]);
         }
 
-        g_free (schema);
+        return index;
+}
 
-        return NULL;
+static GSettings *
+xsettings_gsettings_new (const char *schema)
+{
+        GSettings *gsettings;
+
+        gsettings = g_settings_new (schema);
+        g_object_set_qdata (G_OBJECT (gsettings), schema_qdata_quark (),
+                            GUINT_TO_POINTER (g_quark_from_static_string (schema)));
+
+        return gsettings;
+}
+
+static TranslationEntry *
+find_translation_entry (MateXSettingsManager *manager,
+                        GSettings            *gsettings,
+                        const char           *key)
+{
+        GQuark schema_quark;
+        GQuark key_quark;
+        gint64 index_key;
+
+        schema_quark = GPOINTER_TO_UINT (g_object_get_qdata (G_OBJECT (gsettings),
+                                                             schema_qdata_quark ()));
+        key_quark = g_quark_try_string (key);
+        if (schema_quark == 0 || key_quark == 0)
+                return NULL;
+
+        index_key = ((gint64) schema_quark << 32) | key_quark;
+
+        return g_hash_table_lookup (manager->priv->translation_index, &index_key);
 }
 
 static void
@@ -836,7 +1087,6 @@ xsettings_callback (GSettings             *gsettings,
                     MateXSettingsManager  *manager)
 {
         TranslationEntry *trans;
-        int               i;
         GVariant         *value;
 
         if (g_str_equal (key, CURSOR_THEME_KEY) ||
@@ -846,7 +1096,7 @@ xsettings_callback (GSettings             *gsettings,
                 return;
 	}
 
-        trans = find_translation_entry (gsettings, key);
+        trans = find_translation_entry (manager, gsettings, key);
         if (trans == NULL) {
                 return;
         }
@@ -857,15 +1107,7 @@ xsettings_callback (GSettings             *gsettings,
 
         g_variant_unref (value);
 
-        for (i = 0; manager->priv->managers [i]; i++) {
-                xsettings_manager_set_string (manager->priv->managers [i],
-                                              "Net/FallbackIconTheme",
-                                              "mate");
-        }
-
-        for (i = 0; manager->priv->managers [i]; i++) {
-                xsettings_manager_notify (manager->priv->managers [i]);
-        }
+        queue_flush (manager, FALSE);
 }
 
 static void
@@ -908,6 +1150,9 @@ setup_xsettings_managers (MateXSettingsManager *manager)
                 return FALSE;
         }
 
+        /* children spawned by the daemon must not inherit the connection */
+        fcntl (ConnectionNumber (xdisplay), F_SETFD, FD_CLOEXEC);
+
 #ifdef GDK_WINDOWING_WAYLAND
         /* When running on Wayland the XSETTINGS manager uses its own Xlib
          * connection to XWayland, which nothing else watches.  Now that we
@@ -960,15 +1205,21 @@ mate_xsettings_manager_start (MateXSettingsManager *manager,
                 return FALSE;
         }
 
+        /* Publish the initial settings with a single property write */
+        for (i = 0; manager->priv->managers [i]; i++)
+                xsettings_manager_begin_batch (manager->priv->managers [i]);
+
         manager->priv->gsettings = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                          NULL, (GDestroyNotify) g_object_unref);
 
         g_hash_table_insert (manager->priv->gsettings,
-                             MOUSE_SCHEMA, g_settings_new (MOUSE_SCHEMA));
+                             MOUSE_SCHEMA, xsettings_gsettings_new (MOUSE_SCHEMA));
         g_hash_table_insert (manager->priv->gsettings,
-                             INTERFACE_SCHEMA, g_settings_new (INTERFACE_SCHEMA));
+                             INTERFACE_SCHEMA, xsettings_gsettings_new (INTERFACE_SCHEMA));
         g_hash_table_insert (manager->priv->gsettings,
-                             SOUND_SCHEMA, g_settings_new (SOUND_SCHEMA));
+                             SOUND_SCHEMA, xsettings_gsettings_new (SOUND_SCHEMA));
+
+        manager->priv->translation_index = translation_index_new ();
 
         list = g_hash_table_get_values (manager->priv->gsettings);
         for (l = list; l != NULL; l = l->next) {
@@ -1028,6 +1279,9 @@ mate_xsettings_manager_start (MateXSettingsManager *manager,
         }
         g_variant_unref (overrides);
 
+        for (i = 0; manager->priv->managers [i]; i++)
+                xsettings_manager_commit (manager->priv->managers [i]);
+
         mate_settings_profile_end (NULL);
 
         return TRUE;
@@ -1041,6 +1295,15 @@ mate_xsettings_manager_stop (MateXSettingsManager *manager)
 
         g_debug ("Stopping xsettings manager");
 
+        if (p->flush_id != 0) {
+                g_source_remove (p->flush_id);
+                p->flush_id = 0;
+        }
+        p->xft_dirty = FALSE;
+        p->pending_changes = 0;
+
+        g_clear_pointer (&p->xresources, xresource_db_free);
+
         if (p->managers != NULL) {
                 for (i = 0; p->managers [i]; ++i)
                         xsettings_manager_destroy (p->managers [i]);
@@ -1059,6 +1322,11 @@ mate_xsettings_manager_stop (MateXSettingsManager *manager)
                 p->gsettings = NULL;
         }
 
+        if (p->translation_index != NULL) {
+                g_hash_table_destroy (p->translation_index);
+                p->translation_index = NULL;
+        }
+
         if (p->gsettings_font != NULL) {
                 g_object_unref (p->gsettings_font);
                 p->gsettings_font = NULL;
@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+/* Measures set and notify throughput of the XSETTINGS manager.  It
+ * claims the XSETTINGS selection of the default screen, so run it on a
+ * display without a settings daemon, e.g. under Xvfb.
+ *
+ * Usage: test-xsettings-benchmark [N_SETTINGS] [N_UPDATES]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "xsettings-manager.h"
+
+static void
+terminate_cb (void *data G_GNUC_UNUSED)
+{
+        g_printerr ("Lost the XSETTINGS selection\n");
+        exit (1);
+}
+
+static void
+report (const char *what,
+        int         n,
+        gint64      start)
+{
+        gint64 elapsed = g_get_monotonic_time () - start;
+
+        g_print ("%-28s %8d ops, %10.1f ns/op\n", what, n, elapsed * 1000.0 / MAX (n, 1));
+}
+
+int
+main (int argc, char *argv[])
+{
+        XSettingsManager *manager;
+        Display          *display;
+        char            **names;
+        int              *values;
+        gint64            start;
+        int               n_settings = 200;
+        int               n_updates = 100000;
+        int               i;
+
+        if (argc > 1)
+                n_settings = MAX (atoi (argv[1]), 1);
+        if (argc > 2)
+                n_updates = MAX (atoi (argv[2]), 1);
+
+        display = XOpenDisplay (NULL);
+        if (display == NULL) {
+                g_printerr ("Unable to open X display\n");
+                return 1;
+        }
+
+        if (xsettings_manager_check_running (display, DefaultScreen (display))) {
+                g_printerr ("An XSETTINGS manager is already running on this display\n");
+                return 1;
+        }
+
+        manager = xsettings_manager_new (display, DefaultScreen (display), terminate_cb, NULL);
+        if (manager == NULL)
+                return 1;
+
+        /* Insert in reverse order, the worst case for a sorted store */
+        names = g_new0 (char *, n_settings);
+        values = g_new0 (int, n_settings);
+        for (i = 0; i < n_settings; i++)
+                names[i] = g_strdup_printf ("Bench/Setting%06d", n_settings - i);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_settings; i++)
+                xsettings_manager_set_int (manager, names[i], i);
+        report ("bulk load", n_settings, start);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_updates; i++) {
+                xsettings_manager_set_int (manager, names[i % n_settings], i);
+                values[i % n_settings] = i;
+        }
+        report ("update", n_updates, start);
+
+        /* Write back exactly what each setting already holds */
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_updates; i++)
+                xsettings_manager_set_int (manager, names[i % n_settings], values[i % n_settings]);
+        report ("unchanged update", n_updates, start);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_updates / 100; i++) {
+                xsettings_manager_set_string (manager, names[i % n_settings],
+                                              (i & 1) ? "value-a" : "value-b");
+                xsettings_manager_notify (manager);
+        }
+        XSync (display, False);
+        report ("update + notify", n_updates / 100, start);
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_updates / 100; i++) {
+                int j;
+
+                xsettings_manager_begin_batch (manager);
+                for (j = 0; j < 32; j++) {
+                        xsettings_manager_set_int (manager, names[(i + j) % n_settings], i + j);
+                        xsettings_manager_notify (manager);
+                }
+                xsettings_manager_commit (manager);
+        }
+        XSync (display, False);
+        report ("batch of 32 + commit", n_updates / 100, start);
+
+        for (i = 0; i < n_settings; i++)
+                g_free (names[i]);
+        g_free (names);
+        g_free (values);
+
+        xsettings_manager_destroy (manager);
+        XCloseDisplay (display);
+
+        return 0;
+}
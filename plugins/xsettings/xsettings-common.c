@@ -26,6 +26,7 @@
 
 #include <X11/Xlib.h>
 #include <X11/Xmd.h>		/* For CARD32 */
+#include <glib.h>
 
 #include "xsettings-common.h"
 
@@ -78,45 +79,6 @@ xsettings_setting_copy (XSettingsSetting *setting)
   return NULL;
 }
 
-XSettingsList *
-xsettings_list_copy (XSettingsList *list)
-{
-  XSettingsList *new = NULL;
-  XSettingsList *old_iter = list;
-  XSettingsList *new_iter = NULL;
-
-  while (old_iter)
-    {
-      XSettingsList *new_node;
-
-      new_node = malloc (sizeof *new_node);
-      if (!new_node)
-	goto error;
-
-      new_node->setting = xsettings_setting_copy (old_iter->setting);
-      if (!new_node->setting)
-	{
-	  free (new_node);
-	  goto error;
-	}
-
-      if (new_iter)
-	new_iter->next = new_node;
-      else
-	new = new_node;
-
-      new_iter = new_node;
-
-      old_iter = old_iter->next;
-    }
-
-  return new;
-
- error:
-  xsettings_list_free (new);
-  return NULL;
-}
-
 int
 xsettings_setting_equal (XSettingsSetting *setting_a,
 			 XSettingsSetting *setting_b)
@@ -155,106 +117,136 @@ xsettings_setting_free (XSettingsSetting *setting)
   free (setting);
 }
 
+XSettingsTable *
+xsettings_table_new (void)
+{
+  XSettingsTable *table;
+
+  table = malloc (sizeof *table);
+  if (!table)
+    return NULL;
+
+  table->entries = NULL;
+  table->n_entries = 0;
+  table->n_allocated = 0;
+
+  return table;
+}
+
 void
-xsettings_list_free (XSettingsList *list)
+xsettings_table_free (XSettingsTable *table)
 {
-  while (list)
+  int i;
+
+  if (!table)
+    return;
+
+  for (i = 0; i < table->n_entries; i++)
+    xsettings_setting_free (table->entries[i].setting);
+
+  free (table->entries);
+  free (table);
+}
+
+/* Binary search; returns whether @name is present and sets @index to
+ * its position, or to the position it would be inserted at. */
+static int
+table_search (XSettingsTable *table,
+	      const char     *name,
+	      int            *index)
+{
+  int low = 0;
+  int high = table->n_entries;
+
+  while (low < high)
     {
-      XSettingsList *next = list->next;
+      int mid = low + (high - low) / 2;
+      int cmp;
 
-      xsettings_setting_free (list->setting);
-      free (list);
+      if (table->entries[mid].name == name)
+	cmp = 0;
+      else
+	cmp = strcmp (name, table->entries[mid].name);
 
-      list = next;
+      if (cmp == 0)
+	{
+	  *index = mid;
+	  return 1;
+	}
+      else if (cmp < 0)
+	high = mid;
+      else
+	low = mid + 1;
     }
+
+  *index = low;
+  return 0;
 }
 
 XSettingsResult
-xsettings_list_insert (XSettingsList    **list,
-		       XSettingsSetting  *setting)
+xsettings_table_insert (XSettingsTable   *table,
+			XSettingsSetting *setting)
 {
-  XSettingsList *node;
-  XSettingsList *iter;
-  XSettingsList *last = NULL;
+  XSettingsEntry *entry;
+  int index;
 
-  node = malloc (sizeof *node);
-  if (!node)
-    return XSETTINGS_NO_MEM;
-  node->setting = setting;
+  if (table_search (table, setting->name, &index))
+    return XSETTINGS_DUPLICATE_ENTRY;
 
-  iter = *list;
-  while (iter)
+  if (table->n_entries == table->n_allocated)
     {
-      int cmp = strcmp (setting->name, iter->setting->name);
+      XSettingsEntry *entries;
+      int n_allocated;
 
-      if (cmp < 0)
-	break;
-      else if (cmp == 0)
-	{
-	  free (node);
-	  return XSETTINGS_DUPLICATE_ENTRY;
-	}
+      n_allocated = table->n_allocated ? table->n_allocated * 2 : 64;
+      entries = realloc (table->entries, n_allocated * sizeof *entries);
+      if (!entries)
+	return XSETTINGS_NO_MEM;
 
-      last = iter;
-      iter = iter->next;
+      table->entries = entries;
+      table->n_allocated = n_allocated;
     }
 
-  if (last)
-    last->next = node;
-  else
-    *list = node;
+  memmove (&table->entries[index + 1], &table->entries[index],
+	   (table->n_entries - index) * sizeof *table->entries);
+  table->n_entries++;
 
-  node->next = iter;
+  entry = &table->entries[index];
+  entry->name = g_intern_string (setting->name);
+  entry->setting = setting;
+  entry->encoded_offset = 0;
 
   return XSETTINGS_SUCCESS;
 }
 
 XSettingsResult
-xsettings_list_delete (XSettingsList **list,
-		       const char     *name)
+xsettings_table_delete (XSettingsTable *table,
+			const char     *name)
 {
-  XSettingsList *iter;
-  XSettingsList *last = NULL;
+  int index;
 
-  iter = *list;
-  while (iter)
-    {
-      if (strcmp (name, iter->setting->name) == 0)
-	{
-	  if (last)
-	    last->next = iter->next;
-	  else
-	    *list = iter->next;
-
-	  xsettings_setting_free (iter->setting);
-	  free (iter);
+  if (!table_search (table, name, &index))
+    return XSETTINGS_FAILED;
 
-	  return XSETTINGS_SUCCESS;
-	}
+  xsettings_setting_free (table->entries[index].setting);
 
-      last = iter;
-      iter = iter->next;
-    }
+  table->n_entries--;
+  memmove (&table->entries[index], &table->entries[index + 1],
+	   (table->n_entries - index) * sizeof *table->entries);
 
-  return XSETTINGS_FAILED;
+  return XSETTINGS_SUCCESS;
 }
 
-XSettingsSetting *
-xsettings_list_lookup (XSettingsList *list,
-		       const char    *name)
+XSettingsEntry *
+xsettings_table_lookup (XSettingsTable *table,
+			const char     *name)
 {
-  XSettingsList *iter;
-
-  iter = list;
-  while (iter)
-    {
-      if (strcmp (name, iter->setting->name) == 0)
-	return iter->setting;
+  int index;
 
-      iter = iter->next;
-    }
+  if (!table_search (table, name, &index))
+    return NULL;
 
-  return NULL;
+  return &table->entries[index];
 }
 
 char
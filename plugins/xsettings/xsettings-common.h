@@ -30,7 +30,8 @@ extern "C" {
 
 typedef struct _XSettingsBuffer  XSettingsBuffer;
 typedef struct _XSettingsColor   XSettingsColor;
-typedef struct _XSettingsList    XSettingsList;
+typedef struct _XSettingsEntry   XSettingsEntry;
+typedef struct _XSettingsTable   XSettingsTable;
 typedef struct _XSettingsSetting XSettingsSetting;
 
 /* Types of settings possible. Enum values correspond to
@@ -66,10 +67,24 @@ struct _XSettingsColor
   unsigned short red, green, blue, alpha;
 };
 
-struct _XSettingsList
+/* Settings are kept in a contiguous table sorted by name, which is
+ * also the order they are serialized in.  Entry names are interned, so
+ * they stay valid while the setting itself is replaced.
+ */
+struct _XSettingsEntry
 {
+  const char *name;
   XSettingsSetting *setting;
-  XSettingsList *next;
+
+  /* Offset of the setting in the manager's encoded property */
+  size_t encoded_offset;
+};
+
+struct _XSettingsTable
+{
+  XSettingsEntry *entries;
+  int n_entries;
+  int n_allocated;
 };
 
 struct _XSettingsSetting
@@ -91,14 +106,14 @@ void              xsettings_setting_free  (XSettingsSetting *setting);
 int               xsettings_setting_equal (XSettingsSetting *setting_a,
 					   XSettingsSetting *setting_b);
 
-void              xsettings_list_free   (XSettingsList     *list);
-XSettingsList    *xsettings_list_copy   (XSettingsList     *list);
-XSettingsResult   xsettings_list_insert (XSettingsList    **list,
-					 XSettingsSetting  *setting);
-XSettingsSetting *xsettings_list_lookup (XSettingsList     *list,
-					 const char        *name);
-XSettingsResult   xsettings_list_delete (XSettingsList    **list,
-					 const char        *name);
+XSettingsTable   *xsettings_table_new    (void);
+void              xsettings_table_free   (XSettingsTable    *table);
+XSettingsResult   xsettings_table_insert (XSettingsTable    *table,
+					  XSettingsSetting  *setting);
+XSettingsEntry   *xsettings_table_lookup (XSettingsTable    *table,
+					  const char        *name);
+XSettingsResult   xsettings_table_delete (XSettingsTable    *table,
+					  const char        *name);
 
 char xsettings_byte_order (void);
 
@@ -43,13 +43,32 @@ struct _XSettingsManager
   XSettingsTerminateFunc terminate;
   void *cb_data;
 
-  XSettingsList *settings;
   unsigned long serial;
 
   GVariant *overrides;
+
+  /* Generation of the settings last written to this screen, and the
+   * state of an open begin_batch()/commit() section. */
+  unsigned long published_generation;
+  Bool published;
+  int batch_depth;
+  Bool notify_pending;
 };
 
-static XSettingsList *settings;
+static XSettingsTable *settings;
+
+/* The settings are shared by the managers of all screens, and so is
+ * their encoding: the _XSETTINGS_SETTINGS property is kept serialized
+ * here, with room for the 12 byte header at the front, and each change
+ * that keeps a setting's encoded size is patched into it in place.  Any
+ * other change invalidates the cache and the next notify re-encodes it.
+ */
+static unsigned long settings_generation = 1;
+static unsigned char *cache_data;
+static size_t cache_len;
+static size_t cache_alloc;
+static int cache_n_settings;
+static Bool cache_valid;
 
 typedef struct
 {
@@ -132,6 +151,13 @@ xsettings_manager_new (Display                *display,
 
   char buffer[256];
 
+  if (!settings)
+    {
+      settings = xsettings_table_new ();
+      if (!settings)
+        return NULL;
+    }
+
   manager = malloc (sizeof *manager);
   if (!manager)
     return NULL;
@@ -147,9 +173,12 @@ xsettings_manager_new (Display                *display,
   manager->terminate = terminate;
   manager->cb_data = cb_data;
 
-  manager->settings = NULL;
   manager->serial = 0;
   manager->overrides = NULL;
+  manager->published_generation = 0;
+  manager->published = False;
+  manager->batch_depth = 0;
+  manager->notify_pending = False;
 
   manager->window = XCreateSimpleWindow (display,
 					 RootWindow (display, screen),
@@ -201,8 +230,6 @@ xsettings_manager_destroy (XSettingsManager *manager)
 {
   XDestroyWindow (manager->display, manager->window);
 
-  xsettings_list_free (manager->settings);
-
   if (manager->overrides)
     g_variant_unref (manager->overrides);
 
@@ -230,36 +257,78 @@ xsettings_manager_process_event (XSettingsManager *manager,
   return False;
 }
 
+static size_t setting_length (XSettingsSetting *setting);
+static void   setting_store  (XSettingsSetting *setting,
+                              XSettingsBuffer  *buffer);
+
 XSettingsResult
 xsettings_manager_delete_setting (XSettingsManager *manager,
                                   const char       *name)
 {
-  return xsettings_list_delete (&settings, name);
+  XSettingsResult result;
+
+  result = xsettings_table_delete (settings, name);
+  if (result == XSETTINGS_SUCCESS)
+    {
+      cache_valid = False;
+      settings_generation++;
+    }
+
+  return result;
+}
+
+/* Re-encodes @setting over the cached encoding of @entry if both take
+ * the same space; returns False if the cache has to be rebuilt. */
+static Bool
+cache_patch (XSettingsEntry   *entry,
+             XSettingsSetting *setting)
+{
+  XSettingsBuffer buffer;
+
+  if (!cache_valid ||
+      setting_length (entry->setting) != setting_length (setting))
+    return False;
+
+  buffer.pos = cache_data + entry->encoded_offset;
+  setting_store (setting, &buffer);
+
+  return True;
 }
 
 XSettingsResult
 xsettings_manager_set_setting (XSettingsManager *manager,
 			       XSettingsSetting *setting)
 {
-  XSettingsSetting *old_setting = xsettings_list_lookup (settings, setting->name);
+  XSettingsEntry *entry = xsettings_table_lookup (settings, setting->name);
   XSettingsSetting *new_setting;
   XSettingsResult result;
 
-  if (old_setting)
-    {
-      if (xsettings_setting_equal (old_setting, setting))
-	return XSETTINGS_SUCCESS;
-
-      xsettings_list_delete (&settings, setting->name);
-    }
+  if (entry && xsettings_setting_equal (entry->setting, setting))
+    return XSETTINGS_SUCCESS;
 
   new_setting = xsettings_setting_copy (setting);
   if (!new_setting)
     return XSETTINGS_NO_MEM;
 
   new_setting->last_change_serial = manager->serial;
+  settings_generation++;
+
+  /* Updates keep the setting's slot, so the table order and the offsets
+   * of all other cached settings stay valid. */
+  if (entry)
+    {
+      if (!cache_patch (entry, new_setting))
+        cache_valid = False;
+
+      xsettings_setting_free (entry->setting);
+      entry->setting = new_setting;
+
+      return XSETTINGS_SUCCESS;
+    }
 
-  result = xsettings_list_insert (&settings, new_setting);
+  cache_valid = False;
+
+  result = xsettings_table_insert (settings, new_setting);
 
   if (result != XSETTINGS_SUCCESS)
     xsettings_setting_free (new_setting);
@@ -391,47 +460,78 @@ setting_store (XSettingsSetting *setting,
     }
 }
 
-XSettingsResult
-xsettings_manager_notify (XSettingsManager *manager)
+static XSettingsResult
+cache_rebuild (void)
 {
   XSettingsBuffer buffer;
-  XSettingsList *iter;
-  int n_settings = 0;
+  size_t len = 12;		/* byte-order + pad + SERIAL + N_SETTINGS */
+  int i;
 
-  buffer.len = 12;		/* byte-order + pad + SERIAL + N_SETTINGS */
+  for (i = 0; i < settings->n_entries; i++)
+    len += setting_length (settings->entries[i].setting);
 
-  iter = settings;
-  while (iter)
+  if (len > cache_alloc)
     {
-      buffer.len += setting_length (iter->setting);
-      n_settings++;
-      iter = iter->next;
+      unsigned char *data;
+
+      data = realloc (cache_data, len);
+      if (!data)
+        return XSETTINGS_NO_MEM;
+
+      cache_data = data;
+      cache_alloc = len;
     }
 
-  buffer.data = buffer.pos = malloc (buffer.len);
-  if (!buffer.data)
-    return XSETTINGS_NO_MEM;
+  buffer.data = cache_data;
+  buffer.len = len;
+  buffer.pos = cache_data + 12;
+
+  for (i = 0; i < settings->n_entries; i++)
+    {
+      settings->entries[i].encoded_offset = buffer.pos - buffer.data;
+      setting_store (settings->entries[i].setting, &buffer);
+    }
 
-  *buffer.pos = xsettings_byte_order ();
+  cache_len = len;
+  cache_n_settings = settings->n_entries;
+  cache_valid = True;
 
-  buffer.pos += 4;
-  *(CARD32 *)buffer.pos = manager->serial++;
-  buffer.pos += 4;
-  *(CARD32 *)buffer.pos = n_settings;
-  buffer.pos += 4;
+  return XSETTINGS_SUCCESS;
+}
 
-  iter = settings;
-  while (iter)
+XSettingsResult
+xsettings_manager_notify (XSettingsManager *manager)
+{
+  if (manager->batch_depth > 0)
     {
-      setting_store (iter->setting, &buffer);
-      iter = iter->next;
+      manager->notify_pending = True;
+      return XSETTINGS_SUCCESS;
     }
 
+  /* Nothing changed since this screen was last updated */
+  if (manager->published && manager->published_generation == settings_generation)
+    return XSETTINGS_SUCCESS;
+
+  if (!cache_valid)
+    {
+      XSettingsResult result;
+
+      result = cache_rebuild ();
+      if (result != XSETTINGS_SUCCESS)
+        return result;
+    }
+
+  cache_data[0] = xsettings_byte_order ();
+  cache_data[1] = cache_data[2] = cache_data[3] = 0;
+  *(CARD32 *)(cache_data + 4) = manager->serial++;
+  *(CARD32 *)(cache_data + 8) = cache_n_settings;
+
   XChangeProperty (manager->display, manager->window,
 		   manager->xsettings_atom, manager->xsettings_atom,
-		   8, PropModeReplace, buffer.data, buffer.len);
+		   8, PropModeReplace, cache_data, cache_len);
 
-  free (buffer.data);
+  manager->published = True;
+  manager->published_generation = settings_generation;
 
   /* See the note in xsettings_manager_new(): on Wayland nothing else
    * flushes this connection, so without this clients never see the
@@ -441,6 +541,25 @@ xsettings_manager_notify (XSettingsManager *manager)
   return XSETTINGS_SUCCESS;
 }
 
+void
+xsettings_manager_begin_batch (XSettingsManager *manager)
+{
+  manager->batch_depth++;
+}
+
+XSettingsResult
+xsettings_manager_commit (XSettingsManager *manager)
+{
+  g_return_val_if_fail (manager->batch_depth > 0, XSETTINGS_FAILED);
+
+  if (--manager->batch_depth > 0 || !manager->notify_pending)
+    return XSETTINGS_SUCCESS;
+
+  manager->notify_pending = False;
+
+  return xsettings_manager_notify (manager);
+}
+
 #define XSETTINGS_VARIANT_TYPE_COLOR  (G_VARIANT_TYPE ("(qqqq)"))
 
 void
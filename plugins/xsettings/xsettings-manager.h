@@ -63,6 +63,8 @@ XSettingsResult xsettings_manager_set_color      (XSettingsManager       *manage
                                                   const char             *name,
                                                   const XSettingsColor   *value);
 XSettingsResult xsettings_manager_notify         (XSettingsManager *manager);
+void            xsettings_manager_begin_batch    (XSettingsManager *manager);
+XSettingsResult xsettings_manager_commit         (XSettingsManager *manager);
 void            xsettings_manager_set_overrides  (XSettingsManager *manager,
                                                   GVariant         *overrides);
 